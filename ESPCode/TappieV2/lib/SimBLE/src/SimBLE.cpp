@@ -0,0 +1,297 @@
+#include "SimBLE.h"
+#include <string.h>
+
+esp_gap_ble_cb_t BLEDevice::s_gapHandler = nullptr;
+
+// ===== SIMULATED LINK =====
+SimLink::SimLink(const SimFaults &faults, uint32_t seed)
+    : m_faults(faults), m_hostConnIntervalMs(faults.connIntervalMs), m_rng(seed ? seed : 1)
+{
+}
+
+/**
+ * Small xorshift generator so every scenario run is reproducible
+ */
+uint32_t SimLink::random(uint32_t bound)
+{
+  m_rng ^= m_rng << 13;
+  m_rng ^= m_rng >> 17;
+  m_rng ^= m_rng << 5;
+  return bound ? m_rng % bound : 0;
+}
+
+void SimLink::advance(uint32_t ms)
+{
+  for (uint32_t i = 0; i < ms; i++)
+  {
+    m_nowMs++;
+    step();
+  }
+}
+
+/**
+ * One millisecond of link activity: stack completion events, host
+ * reconnects and subscribes, injected disconnects, connection events
+ * draining the TX queue and deliveries reaching the host
+ */
+void SimLink::step()
+{
+  if (m_advStartPending)
+  {
+    m_advStartPending = false;
+    esp_ble_gap_cb_param_t param = {};
+    param.adv_start_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    gapEvent(ESP_GAP_BLE_ADV_START_COMPLETE_EVT, &param);
+  }
+
+  if (!m_connected)
+  {
+    if (m_advertising && m_nowMs - m_advertisingSinceMs >= m_faults.reconnectDelayMs)
+    {
+      connect();
+    }
+    return;
+  }
+
+  if (m_faults.disconnectEveryMs && m_nowMs - m_connectedSinceMs >= m_faults.disconnectEveryMs)
+  {
+    m_stats.disconnects++;
+    disconnect();
+    return;
+  }
+
+  if (!m_subscribed && m_faults.subscribeDelayMs && m_nowMs - m_connectedSinceMs >= m_faults.subscribeDelayMs)
+  {
+    subscribe();
+  }
+
+  // Connection event: the controller sends what it can from the TX queue
+  // and the host answers a pending parameter update
+  if (m_nowMs >= m_nextEventMs)
+  {
+    if (m_connParamsPending)
+    {
+      m_connParamsPending = false;
+      if (m_connParamsResult.update_conn_params.status == ESP_BT_STATUS_SUCCESS)
+      {
+        m_faults.connIntervalMs = (m_connParamsResult.update_conn_params.conn_int * 5) / 4;
+      }
+      gapEvent(ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, &m_connParamsResult);
+    }
+
+    m_nextEventMs = m_nowMs + m_faults.connIntervalMs;
+    for (uint8_t sent = 0; sent < m_faults.packetsPerEvent && !m_txQueue.empty(); sent++)
+    {
+      Packet packet = m_txQueue.front();
+      m_txQueue.pop_front();
+
+      if (random(100) < m_faults.lossPercent)
+      {
+        m_stats.lost++;
+        continue;
+      }
+
+      uint32_t extra = m_faults.latencyMinMs;
+      if (m_faults.latencyMaxMs > m_faults.latencyMinMs)
+      {
+        extra += random(m_faults.latencyMaxMs - m_faults.latencyMinMs + 1);
+      }
+      packet.arriveAtMs = m_nowMs + extra;
+      m_inFlight.push_back(packet);
+    }
+  }
+
+  // Deliver in order; a slow host holds up everything behind it
+  while (!m_inFlight.empty() && m_inFlight.front().arriveAtMs <= m_nowMs)
+  {
+    const Packet &packet = m_inFlight.front();
+    m_deliveries.push_back({packet.uuid, packet.value, packet.queuedAtMs, m_nowMs});
+    m_stats.delivered++;
+    m_inFlight.pop_front();
+  }
+}
+
+bool SimLink::enqueue(const std::string &uuid, const std::string &value)
+{
+  if (!m_connected)
+    return false;
+
+  m_stats.notifyCalls++;
+  if (m_txQueue.size() >= m_faults.txBufferSlots)
+  {
+    m_stats.txBufferFull++;
+    return false;
+  }
+
+  m_txQueue.push_back({uuid, value, m_nowMs, 0});
+  return true;
+}
+
+/**
+ * The host answers at the next connection event, picking the upper bound
+ * of the requested interval (1.25ms units) unless it rejects the update
+ */
+void SimLink::requestConnParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout)
+{
+  if (!m_connected)
+    return;
+
+  m_connParamsResult = {};
+  esp_bt_status_t status = ESP_BT_STATUS_SUCCESS;
+  if (random(100) < m_faults.connParamRejectPercent)
+  {
+    m_stats.connParamRejects++;
+    status = ESP_BT_STATUS_FAIL;
+  }
+  m_connParamsResult.update_conn_params.status = status;
+  m_connParamsResult.update_conn_params.min_int = minInterval;
+  m_connParamsResult.update_conn_params.max_int = maxInterval;
+  m_connParamsResult.update_conn_params.latency = latency;
+  m_connParamsResult.update_conn_params.conn_int = maxInterval;
+  m_connParamsResult.update_conn_params.timeout = timeout;
+  m_connParamsPending = true;
+}
+
+void SimLink::gapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+  if (BLEDevice::s_gapHandler)
+  {
+    BLEDevice::s_gapHandler(event, param);
+  }
+}
+
+/**
+ * The host enables notifications on every characteristic that has a CCCD
+ */
+void SimLink::subscribe()
+{
+  m_subscribed = true;
+  if (!m_server)
+    return;
+
+  for (BLECharacteristic *characteristic : m_server->m_characteristics)
+  {
+    BLE2902 *cccd = characteristic->m_cccd;
+    if (cccd == nullptr)
+      continue;
+
+    cccd->setNotifications(true);
+    if (cccd->m_callbacks)
+    {
+      cccd->m_callbacks->onWrite(cccd);
+    }
+  }
+}
+
+void SimLink::connect()
+{
+  m_connected = true;
+  m_advertising = false;
+  m_connectedSinceMs = m_nowMs;
+  m_subscribed = false;
+  m_faults.connIntervalMs = m_hostConnIntervalMs;
+  m_nextEventMs = m_nowMs;
+  if (m_server && m_server->m_callbacks)
+  {
+    // Like the Arduino library, both overloads are called
+    esp_ble_gatts_cb_param_t param = {};
+    static const esp_bd_addr_t hostAddress = {0x5A, 0x11, 0x7E, 0x57, 0x00, 0x01};
+    memcpy(param.connect.remote_bda, hostAddress, sizeof(esp_bd_addr_t));
+    param.connect.conn_params.interval = (m_faults.connIntervalMs * 4) / 5;
+    param.connect.conn_params.timeout = 400;
+    m_server->m_callbacks->onConnect(m_server);
+    m_server->m_callbacks->onConnect(m_server, &param);
+  }
+}
+
+void SimLink::disconnect()
+{
+  if (!m_connected)
+    return;
+
+  m_connected = false;
+  m_connParamsPending = false;
+  m_stats.droppedOnDisconnect += m_txQueue.size() + m_inFlight.size();
+  m_txQueue.clear();
+  m_inFlight.clear();
+
+  // The host is not bonded, so the next connection starts unsubscribed
+  if (m_server)
+  {
+    for (BLECharacteristic *characteristic : m_server->m_characteristics)
+    {
+      if (characteristic->m_cccd)
+      {
+        characteristic->m_cccd->setNotifications(false);
+      }
+    }
+  }
+  if (m_server && m_server->m_callbacks)
+  {
+    m_server->m_callbacks->onDisconnect(m_server);
+  }
+}
+
+// ===== CHARACTERISTIC =====
+BLECharacteristic::BLECharacteristic(const char *uuid, SimLink *link)
+    : m_uuid(uuid), m_link(link)
+{
+}
+
+void BLECharacteristic::addDescriptor(BLEDescriptor *pDescriptor)
+{
+  BLE2902 *cccd = dynamic_cast<BLE2902 *>(pDescriptor);
+  if (cccd)
+  {
+    m_cccd = cccd;
+  }
+}
+
+/**
+ * Like the Arduino library, a notification the host has not enabled is dropped
+ */
+void BLECharacteristic::notify()
+{
+  if (m_cccd && !m_cccd->getNotifications())
+  {
+    if (m_link->isConnected())
+    {
+      m_link->m_stats.notifyDisabled++;
+    }
+    return;
+  }
+  m_link->enqueue(m_uuid, m_value);
+}
+
+// ===== SERVER =====
+BLEServer::BLEServer(SimLink *link) : m_link(link)
+{
+  m_link->m_server = this;
+}
+
+BLECharacteristic *BLEServer::createCharacteristic(const char *uuid)
+{
+  BLECharacteristic *characteristic = new BLECharacteristic(uuid, m_link);
+  m_characteristics.push_back(characteristic);
+  return characteristic;
+}
+
+void BLEServer::disconnect(uint16_t connId)
+{
+  m_link->disconnect();
+}
+
+void BLEServer::startAdvertising()
+{
+  if (m_link->m_connected || m_link->m_advertising)
+    return;
+
+  m_link->m_advertising = true;
+  m_link->m_advertisingSinceMs = m_link->m_nowMs;
+  m_link->m_advStartPending = true;
+}
+
+void BLEServer::updateConnParams(esp_bd_addr_t remote_bda, uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout)
+{
+  m_link->requestConnParams(minInterval, maxInterval, latency, timeout);
+}
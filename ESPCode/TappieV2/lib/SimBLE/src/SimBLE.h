@@ -0,0 +1,274 @@
+/**
+ * SimBLE - Simulated BLE transport for the native build
+ *
+ * Stands in for the ESP32 BLE stack so the firmware's event path (the
+ * TappieLink library) runs unchanged on a desktop. BLECharacteristic,
+ * BLE2902, BLEServer, BLEDevice and the callback classes keep the
+ * signatures of the Arduino BLE library, including the Bluedroid parameter
+ * types the firmware reads, while SimLink models the radio and the host
+ * underneath and injects faults:
+ * - TX buffer exhaustion (notify() dropped when the controller queue is full)
+ * - Extra delivery latency (slow host)
+ * - Packet loss
+ * - Connection parameter update rejections
+ * - Abrupt disconnects
+ * - A host that is slow to enable notifications, or never does
+ *
+ * Time is simulated; call SimLink::advance() to move it forward.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// ===== FAULT CONFIGURATION =====
+struct SimFaults
+{
+  uint8_t txBufferSlots = 8;          // Notifications the controller can queue before notify() is dropped
+  uint8_t packetsPerEvent = 4;        // Notifications sent per connection event
+  uint16_t connIntervalMs = 30;       // Host's connection interval in milliseconds, until an update is accepted
+  uint16_t latencyMinMs = 0;          // Extra host-side delivery delay (lower bound)
+  uint16_t latencyMaxMs = 0;          // Extra host-side delivery delay (upper bound)
+  uint8_t lossPercent = 0;            // Chance a sent notification never reaches the host
+  uint8_t connParamRejectPercent = 0; // Chance a connection parameter update is rejected
+  uint32_t disconnectEveryMs = 0;     // Abrupt disconnect after this long connected (0 = never)
+  uint32_t reconnectDelayMs = 1000;   // Time for the host to reconnect once advertising
+  uint32_t subscribeDelayMs = 50;     // Host enables notifications this long after connecting (0 = never)
+};
+
+// ===== RESULTS =====
+struct SimDelivery
+{
+  std::string uuid;
+  std::string value;
+  uint32_t queuedAtMs;
+  uint32_t deliveredAtMs;
+};
+
+struct SimStats
+{
+  uint32_t notifyCalls = 0;         // notify() calls made while connected
+  uint32_t notifyDisabled = 0;      // Dropped because the host had not enabled notifications
+  uint32_t txBufferFull = 0;        // Dropped because the TX queue was full
+  uint32_t lost = 0;                // Sent over the air but lost
+  uint32_t droppedOnDisconnect = 0; // Still queued when the link went down
+  uint32_t delivered = 0;           // Reached the host
+  uint32_t connParamRejects = 0;    // Rejected connection parameter updates
+  uint32_t disconnects = 0;         // Abrupt disconnects injected
+};
+
+// ===== BLUEDROID TYPES =====
+// The subset of the ESP-IDF types the firmware's callbacks read
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef enum
+{
+  ESP_BT_STATUS_SUCCESS = 0,
+  ESP_BT_STATUS_FAIL,
+} esp_bt_status_t;
+
+typedef enum
+{
+  ESP_GAP_BLE_ADV_START_COMPLETE_EVT,
+  ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+} esp_gap_ble_cb_event_t;
+
+typedef union
+{
+  struct
+  {
+    esp_bt_status_t status;
+  } adv_start_cmpl;
+  struct
+  {
+    esp_bt_status_t status;
+    esp_bd_addr_t bda;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t conn_int;
+    uint16_t timeout;
+  } update_conn_params;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+typedef struct
+{
+  uint16_t interval; // 1.25ms units
+  uint16_t latency;
+  uint16_t timeout;  // 10ms units
+} esp_gatt_conn_params_t;
+
+typedef union
+{
+  struct
+  {
+    uint16_t conn_id;
+    esp_bd_addr_t remote_bda;
+    esp_gatt_conn_params_t conn_params;
+  } connect;
+} esp_ble_gatts_cb_param_t;
+
+class BLEServer;
+class BLECharacteristic;
+class BLEDescriptor;
+
+class BLEServerCallbacks
+{
+public:
+  virtual ~BLEServerCallbacks() {}
+  virtual void onConnect(BLEServer *pServer) {}
+  virtual void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) {}
+  virtual void onDisconnect(BLEServer *pServer) {}
+};
+
+class BLEDescriptorCallbacks
+{
+public:
+  virtual ~BLEDescriptorCallbacks() {}
+  virtual void onWrite(BLEDescriptor *pDescriptor) {}
+};
+
+/**
+ * The simulated radio link between one peripheral and one host
+ */
+class SimLink
+{
+public:
+  explicit SimLink(const SimFaults &faults, uint32_t seed = 1);
+
+  uint32_t now() const { return m_nowMs; }
+  void advance(uint32_t ms);
+
+  bool isConnected() const { return m_connected; }
+  uint16_t connIntervalMs() const { return m_faults.connIntervalMs; }
+
+  const SimStats &stats() const { return m_stats; }
+  const std::vector<SimDelivery> &deliveries() const { return m_deliveries; }
+
+private:
+  friend class BLECharacteristic;
+  friend class BLEServer;
+
+  struct Packet
+  {
+    std::string uuid;
+    std::string value;
+    uint32_t queuedAtMs;
+    uint32_t arriveAtMs;
+  };
+
+  bool enqueue(const std::string &uuid, const std::string &value);
+  void requestConnParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+  void connect();
+  void disconnect();
+  void subscribe();
+  void gapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+  uint32_t random(uint32_t bound);
+  void step();
+
+  SimFaults m_faults;
+  uint16_t m_hostConnIntervalMs; // Every connection starts on the host's interval
+  uint32_t m_rng;
+  uint32_t m_nowMs = 0;
+  bool m_connected = false;
+  bool m_advertising = false;
+  uint32_t m_advertisingSinceMs = 0;
+  bool m_advStartPending = false;
+  uint32_t m_connectedSinceMs = 0;
+  bool m_subscribed = false;
+  uint32_t m_nextEventMs = 0;
+  bool m_connParamsPending = false;
+  esp_ble_gap_cb_param_t m_connParamsResult = {};
+  BLEServer *m_server = nullptr;
+  std::deque<Packet> m_txQueue;
+  std::deque<Packet> m_inFlight;
+  std::vector<SimDelivery> m_deliveries;
+  SimStats m_stats;
+};
+
+class BLEDescriptor
+{
+public:
+  virtual ~BLEDescriptor() {}
+  void setCallbacks(BLEDescriptorCallbacks *pCallbacks) { m_callbacks = pCallbacks; }
+
+private:
+  friend class SimLink;
+
+  BLEDescriptorCallbacks *m_callbacks = nullptr;
+};
+
+/**
+ * Client Characteristic Configuration, written by the host to enable notifications
+ */
+class BLE2902 : public BLEDescriptor
+{
+public:
+  bool getNotifications() const { return m_notifications; }
+  void setNotifications(bool flag) { m_notifications = flag; }
+
+private:
+  bool m_notifications = false;
+};
+
+class BLECharacteristic
+{
+public:
+  BLECharacteristic(const char *uuid, SimLink *link);
+
+  void setValue(const char *value) { m_value = value; }
+  void setValue(const std::string &value) { m_value = value; }
+  void setValue(uint8_t *data, size_t length) { m_value.assign((const char *)data, length); }
+  std::string getValue() const { return m_value; }
+  uint8_t *getData() { return (uint8_t *)m_value.data(); }
+  size_t getLength() const { return m_value.size(); }
+  void addDescriptor(BLEDescriptor *pDescriptor);
+  void notify();
+
+private:
+  friend class SimLink;
+
+  std::string m_uuid;
+  std::string m_value;
+  BLE2902 *m_cccd = nullptr;
+  SimLink *m_link;
+};
+
+class BLEServer
+{
+public:
+  explicit BLEServer(SimLink *link);
+
+  void setCallbacks(BLEServerCallbacks *pCallbacks) { m_callbacks = pCallbacks; }
+  BLECharacteristic *createCharacteristic(const char *uuid);
+  uint16_t getConnId() const { return 0; }
+  uint32_t getConnectedCount() const { return m_link->isConnected() ? 1 : 0; }
+  void disconnect(uint16_t connId);
+  void startAdvertising();
+  void updateConnParams(esp_bd_addr_t remote_bda, uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+
+private:
+  friend class SimLink;
+
+  SimLink *m_link;
+  BLEServerCallbacks *m_callbacks = nullptr;
+  std::vector<BLECharacteristic *> m_characteristics;
+};
+
+class BLEDevice
+{
+public:
+  static void setCustomGapHandler(esp_gap_ble_cb_t handler) { s_gapHandler = handler; }
+  static void deinit(bool releaseMemory) {}
+
+private:
+  friend class SimLink;
+
+  static esp_gap_ble_cb_t s_gapHandler;
+};
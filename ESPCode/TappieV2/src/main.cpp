@@ -16,15 +16,23 @@
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#include <BLEHIDDevice.h>
+#include <BLESecurity.h>
+#include <Preferences.h>
 #include <ESP32Encoder.h>
 #include <OneButton.h>
 #include <esp_sleep.h>
+#include <esp_mac.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
 #include <driver/periph_ctrl.h>
 #include <driver/adc.h>
+#include <BleLink.h>
+#include <EncoderReport.h>
 
 // ===== PIN DEFINITIONS =====
 #define ENCODER_PIN_DT 32
-#define ENCODER_PIN_CLK 35
+#define ENCODER_PIN_CLK 35 // GPIO34-39 have no internal pulls, CLK needs an external pull-up
 #define ENCODER_PIN_SW 34
 
 gpio_num_t reedSwitchPin = GPIO_NUM_15; // GPIO pin for reed switch
@@ -36,26 +44,51 @@ gpio_num_t reedSwitchPin = GPIO_NUM_15; // GPIO pin for reed switch
 #define MasterButtonPin 22
 
 // ===== BLE DEFINITIONS =====
-#define BLE_DEVICE_NAME "TappieV2"
+#define BLE_DEVICE_NAME "TappieV2" // Prefix, the device ID is appended as "-XXXX"
 #define SERVICE_UUID "738b66f1-91b7-4f25-8ab8-31d38d56541a"
 #define ENC_POS_UUID "a9c8c7b4-fb55-4d27-99e4-2c14b5812546"
 #define ENC_BUTTON_UUID "0c2f5fbe-c20f-49ec-8c7c-ce0c9358e574"
 #define MEDIA_SINGLEBUTTON_UUID "9ff67916-665f-4489-b257-46d118b1e5eb"
 #define MEDIA_DOUBLEBUTTON_UUID "66f1ab02-c93d-44fe-8ca9-5e8bdbb2fe80"
+#define IDENTITY_UUID "a565235a-f53e-40c5-99a3-2aba054e033f"
+
+// ===== HID WHEEL DEFINITIONS =====
+#ifndef ENABLE_HID_WHEEL
+#define ENABLE_HID_WHEEL false       // Also expose the encoder as a high-resolution HID wheel (scrolls, needs bonding)
+#endif
+#define HID_WHEEL_REPORT_ID 1
+#define HID_MULTIPLIER_REPORT_ID 2
+#define ENCODER_COUNTS_PER_DETENT 2  // Half-quad PCNT counts per detent, used as the resolution multiplier
+#define HID_WHEEL_DIRECTION 1        // Set to -1 to flip scroll direction
+
+// ===== DEVICE IDENTITY =====
+#define MANUFACTURER_ID 0xFFFF // Bluetooth SIG ID reserved for testing/unassigned use
+#define IDENTITY_NVS_NAMESPACE "tappie"
 
 // ===== TIMING CONSTANTS =====
-#define AUTO_RESET_TIMEOUT 5000 // 5 seconds in milliseconds
 #define BUTTON_NOTIFY_DELAY 100 // 100ms delay after button notifications
 #define BATTERY_CHECK_INTERVAL 300000 // 1 minute in milliseconds
 
 // ===== POWER MANAGEMENT CONSTANTS =====
 #define LIGHT_SLEEP_TIMEOUT 10000  // 10 seconds of inactivity before light sleep
+#ifndef ENABLE_LIGHT_SLEEP
+#define ENABLE_LIGHT_SLEEP false   // Manual light sleep from loop(), no env sets it; needs BLE modem sleep
+#endif
+#ifndef ENABLE_AUTO_LIGHT_SLEEP
+#define ENABLE_AUTO_LIGHT_SLEEP false // PM auto light sleep, needs the ESP-IDF env's sdkconfig
+#endif
+#define LIGHT_SLEEP_MAX_US 500000  // Wake for housekeeping at least every 500ms
+#define WAKE_EDGE_HOLD_MS 60       // Hold a latched wake press past OneButton's 50ms debounce
 #define INACTIVE_CPU_FREQ 40       // CPU MHz when inactive
 #define ACTIVE_CPU_FREQ 80         // CPU MHz when active
 #define BLE_MIN_CONN_INTERVAL 0x40 // 80ms (was 0x20 = 40ms)
 #define BLE_MAX_CONN_INTERVAL 0x80 // 160ms (was 0x40)
 #define DISABLE_UNUSED_PERIPHERALS true
 
+// ===== ENCODER DEEP IDLE CONSTANTS =====
+#define ENCODER_DEEP_IDLE_TIMEOUT 30000 // 30 seconds without rotation before PCNT hands over to a CLK interrupt
+#define ENCODER_PULLUP_SETTLE_US 10     // Time for the DT pull-up to charge the line before reading it
+
 // Add to STATE VARIABLES section
 int currentCpuFreq = ACTIVE_CPU_FREQ;
 
@@ -79,6 +112,22 @@ BLECharacteristic *encPosChara = NULL;
 BLECharacteristic *encButtonChara = NULL;
 BLECharacteristic *mediaButtonChara = NULL;
 BLECharacteristic *mediaDoubleButtonChara = NULL;
+BLECharacteristic *identityChara = NULL;
+
+// Connection lifecycle and encoder notifications, shared with the native sim
+BleLink bleLink;
+EncoderReport encoderReport(ENCODER_COUNTS_PER_DETENT, HID_WHEEL_DIRECTION);
+
+// HID wheel reports
+BLEHIDDevice *hid = NULL;
+BLECharacteristic *wheelInputReport = NULL;
+BLECharacteristic *multiplierFeatureReport = NULL;
+
+// Per-device identity, advertised in the name and manufacturer data
+Preferences preferences;
+uint32_t deviceId = 0; // Low 32 bits of the efuse MAC unless overridden in NVS
+uint8_t deviceRole = 0; // Host-assigned role, stored in NVS
+char deviceName[20];
 
 // Media buttons array
 MediaButton mediaButtons[] = {
@@ -90,15 +139,29 @@ MediaButton mediaButtons[] = {
 const int NUM_MEDIA_BUTTONS = sizeof(mediaButtons) / sizeof(mediaButtons[0]);
 
 // ===== STATE VARIABLES =====
-bool deviceConnected = false;
-bool oldDeviceConnected = false;
-
-// Encoder position tracking
-int prevEncPosition = 0;
-int currentEncPosition = 0;
-
-// Timer for auto-reset
-unsigned long lastActivityTime = 0;
+unsigned long lastInputTime = 0;
+
+// Wake edge latch: which input woke us from light sleep and when
+#define ENC_BUTTON_WAKE_INDEX NUM_MEDIA_BUTTONS
+unsigned long wakeHoldUntil[NUM_MEDIA_BUTTONS + 1] = {0};
+int64_t wakeTimeUs = 0;
+const char *wakeSource = NULL; // Set until the first debounced press or encoder step after the wake
+
+// Auto light sleep: PM lock held while the knob is in use
+esp_pm_lock_handle_t inputPmLock = NULL;
+bool autoLightSleepArmed = false;
+
+// Encoder pause: PCNT stopped for deep idle or light sleep, the first edge
+// on a watched line is decoded by resumeEncoder()
+volatile bool encoderPaused = false;
+volatile bool encoderDeepIdle = false; // Paused after a long rest, the DT pull-up may be off
+volatile bool encoderWoke = false;     // A watched line moved while paused
+volatile unsigned long lastEncoderMoveTime = 0;
+uint8_t idleQuadState = 0;     // Quadrature state when PCNT was paused
+int64_t idleCount = 0;         // PCNT count when PCNT was paused
+bool encoderDtWatched = false; // DT keeps its pull-up and interrupt, otherwise only CLK is watched
+bool encoderWakeArmed = false; // Watched lines are light sleep wake sources
+portMUX_TYPE encoderIdleMux = portMUX_INITIALIZER_UNLOCKED;
 
 // Add these variables to the STATE VARIABLES section
 bool prevReedState = true;               // Store previous reed switch state
@@ -108,21 +171,32 @@ unsigned long lastReedCheckTime = 0;
 
 // ===== FUNCTION DECLARATIONS =====
 void setupBLE();
+void setupIdentity();
+void formatDeviceName();
+void setupHidWheel();
+void configureAdvertising();
 void setupEncoder();
 void setupMediaButtons();
 void resetEncoder();
-void handleConnectionChanges();
+void enterEncoderDeepIdle();
+void encoderClkISR();
+void encoderDtISR();
+void noteInputActivity();
+void reportWakeLatency();
+void requestDeepSleep();
+void configurePowerManagement();
 String getBatteryLevel();
 void enterDeepSleep();
 void sendNotification(BLECharacteristic *characteristic, const char *value);
-class MyServerCallbacks;
 
 /**
  * Helper function to send BLE notifications with auto-reset
  */
 void sendNotification(BLECharacteristic *characteristic, const char *value)
 {
-  if (!deviceConnected)
+  noteInputActivity();
+
+  if (!bleLink.isConnected())
     return;
 
   characteristic->setValue(value);
@@ -146,7 +220,7 @@ void buttonClickCallback(void *parameter)
   Serial.print("Button clicked: ");
   Serial.println(buttonName);
 
-  if (deviceConnected)
+  if (bleLink.isConnected())
   {
     sendNotification(mediaButtonChara, buttonName);
   }
@@ -160,7 +234,7 @@ void buttonDoubleClickCallback(void *parameter)
   Serial.print("Button double clicked: ");
   Serial.println(buttonName);
 
-  if (deviceConnected)
+  if (bleLink.isConnected())
   {
     sendNotification(mediaDoubleButtonChara, buttonName);
   }
@@ -234,32 +308,180 @@ void disableUnusedPeripherals()
 }
 
 
-class MyServerCallbacks : public BLEServerCallbacks
+// ===== DEVICE IDENTITY =====
+/**
+ * Derive the device ID from the efuse MAC, then apply any ID or role
+ * stored in NVS so several knobs can be told apart by one host
+ */
+void formatDeviceName()
+{
+  snprintf(deviceName, sizeof(deviceName), "%s-%04X", BLE_DEVICE_NAME, (unsigned int)(deviceId & 0xFFFF));
+}
+
+void setupIdentity()
+{
+  uint8_t mac[6];
+  esp_efuse_mac_get_default(mac);
+  uint32_t macId = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+
+  preferences.begin(IDENTITY_NVS_NAMESPACE, false);
+  deviceId = preferences.getULong("id", macId);
+  deviceRole = preferences.getUChar("role", 0);
+
+  formatDeviceName();
+  Serial.printf("Device ID %08X, role %u, name %s\n", (unsigned int)deviceId, deviceRole, deviceName);
+}
+
+String getIdentityString()
+{
+  char identity[16];
+  snprintf(identity, sizeof(identity), "%08X %u", (unsigned int)deviceId, deviceRole);
+  return String(identity);
+}
+
+/**
+ * Advertising payload: flags, the service UUID and manufacturer data
+ * carrying the device ID and role, so hosts can filter at scan time.
+ * The name goes in the scan response unless the HID wheel needs the room.
+ */
+void configureAdvertising()
 {
-  void onConnect(BLEServer *pServer)
+  std::string manufacturerData;
+  manufacturerData += (char)(MANUFACTURER_ID & 0xFF);
+  manufacturerData += (char)(MANUFACTURER_ID >> 8);
+  manufacturerData += (char)(deviceId >> 24);
+  manufacturerData += (char)(deviceId >> 16);
+  manufacturerData += (char)(deviceId >> 8);
+  manufacturerData += (char)(deviceId);
+  manufacturerData += (char)deviceRole;
+
+  BLEAdvertisementData advertisementData;
+  BLEAdvertisementData scanResponseData;
+  advertisementData.setFlags(ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
+  advertisementData.setManufacturerData(manufacturerData);
+
+  if (ENABLE_HID_WHEEL)
+  {
+    // The OS needs the HID service and name up front; the 128-bit
+    // service UUID and appearance move to the scan response to fit 31 bytes
+    advertisementData.setCompleteServices(BLEUUID((uint16_t)0x1812));
+    advertisementData.setName(deviceName);
+    scanResponseData.setCompleteServices(BLEUUID(SERVICE_UUID));
+    scanResponseData.setAppearance(ESP_BLE_APPEARANCE_HID_MOUSE);
+  }
+  else
+  {
+    advertisementData.setCompleteServices(BLEUUID(SERVICE_UUID));
+    scanResponseData.setName(deviceName);
+  }
+
+  BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+  pAdvertising->setAdvertisementData(advertisementData);
+  pAdvertising->setScanResponseData(scanResponseData);
+}
+
+/**
+ * Parse all of text as an unsigned number no larger than max
+ */
+bool parseIdentityValue(const String &text, int base, uint32_t max, uint32_t *value)
+{
+  if (text.length() == 0 || text.length() > 8 || !isxdigit(text[0]))
+    return false;
+
+  char *end;
+  unsigned long parsed = strtoul(text.c_str(), &end, base);
+  if (*end != '\0' || parsed > max)
+    return false;
+
+  *value = parsed;
+  return true;
+}
+
+/**
+ * Host writes "role=<0-255>" or "id=<1-8 hex digits>" to reassign this knob.
+ * Stored in NVS and advertised from the next advertising start, the GAP
+ * name follows a new ID straight away. Anything else is rejected and the
+ * characteristic reads back the unchanged identity.
+ */
+class IdentityCallbacks : public BLECharacteristicCallbacks
+{
+  void onWrite(BLECharacteristic *pCharacteristic)
+  {
+    String value = pCharacteristic->getValue().c_str();
+    uint32_t parsed = 0;
+
+    if (value.startsWith("role=") && parseIdentityValue(value.substring(5), 10, 255, &parsed))
+    {
+      deviceRole = (uint8_t)parsed;
+      preferences.putUChar("role", deviceRole);
+    }
+    else if (value.startsWith("id=") && parseIdentityValue(value.substring(3), 16, 0xFFFFFFFF, &parsed))
+    {
+      deviceId = parsed;
+      preferences.putULong("id", deviceId);
+      formatDeviceName();
+      esp_ble_gap_set_device_name(deviceName);
+    }
+    else
+    {
+      Serial.print("Rejected identity command: ");
+      Serial.println(value);
+      pCharacteristic->setValue(getIdentityString().c_str());
+      return;
+    }
+
+    Serial.print("Identity updated: ");
+    Serial.println(getIdentityString());
+    pCharacteristic->setValue(getIdentityString().c_str());
+    configureAdvertising();
+  }
+};
+
+/**
+ * What the firmware does as bleLink moves through the connection lifecycle
+ */
+class TappieLinkCallbacks : public BleLinkCallbacks
+{
+  void onLinkConnected()
   {
-    deviceConnected = true;
-    Serial.println("Device connected");
     resetEncoder(); // Reset encoder position on new connection
   }
 
-  void onDisconnect(BLEServer *pServer)
+  void onLinkReady()
+  {
+    encoderReport.sendPosition();
+  }
+
+  void onLinkDisconnected()
+  {
+    // The next host has to enable the resolution multiplier again
+    encoderReport.setHighResolution(false);
+    if (multiplierFeatureReport != NULL)
+    {
+      uint8_t multiplier = 0;
+      multiplierFeatureReport->setValue(&multiplier, 1);
+    }
+  }
+
+  void onLinkDeinit()
   {
-    deviceConnected = false;
-    Serial.println("Device disconnected");
+    BLEDevice::deinit(true);
+    enterDeepSleep();
   }
 };
 
+TappieLinkCallbacks linkCallbacks;
+
 // Modify setupBLE() to optimize BLE parameters
 void setupBLE()
 {
   // Create the BLE Device
-  BLEDevice::init(BLE_DEVICE_NAME);
+  BLEDevice::init(deviceName);
   BLEDevice::setPower(ESP_PWR_LVL_N12);
 
   // Create the BLE Server
   pServer = BLEDevice::createServer();
-  pServer->setCallbacks(new MyServerCallbacks());
+  pServer->setCallbacks(&bleLink);
 
   // Create the BLE Service
   BLEService *pService = pServer->createService(SERVICE_UUID);
@@ -289,32 +511,144 @@ void setupBLE()
           BLECharacteristic::PROPERTY_WRITE |
           BLECharacteristic::PROPERTY_NOTIFY);
 
+  identityChara = pService->createCharacteristic(
+      IDENTITY_UUID,
+      BLECharacteristic::PROPERTY_READ |
+          BLECharacteristic::PROPERTY_WRITE);
+  identityChara->setCallbacks(new IdentityCallbacks());
+
   // Add descriptor and set initial values
-  encPosChara->addDescriptor(new BLE2902());
+  BLE2902 *encPosCccd = new BLE2902();
+  encPosCccd->setCallbacks(bleLink.subscribeCallbacks());
+  encPosChara->addDescriptor(encPosCccd);
   encButtonChara->addDescriptor(new BLE2902());
   mediaButtonChara->addDescriptor(new BLE2902());
   mediaDoubleButtonChara->addDescriptor(new BLE2902());
 
+  encoderReport.setBatteryLevel(getBatteryLevel().toInt());
   encPosChara->setValue(("0" + getBatteryLevel()).c_str());
   encButtonChara->setValue("0");
   mediaButtonChara->setValue("Master");
   mediaDoubleButtonChara->setValue("0");
+  identityChara->setValue(getIdentityString().c_str());
 
   // Start the service
   pService->start();
 
+  if (ENABLE_HID_WHEEL)
+  {
+    setupHidWheel();
+  }
+
   // Configure and start advertising
   BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
-  pAdvertising->addServiceUUID(SERVICE_UUID);
-  pAdvertising->setScanResponse(true);
+  configureAdvertising();
   pAdvertising->setMinInterval(BLE_MIN_CONN_INTERVAL); // Increased interval (80ms)
   pAdvertising->setMaxInterval(BLE_MAX_CONN_INTERVAL); // Increased interval (160ms)
-  BLEDevice::startAdvertising();
+  encoderReport.begin(encPosChara, wheelInputReport);
+  bleLink.begin(pServer, &linkCallbacks, millis());
 
 
   Serial.println("BLE server ready with optimized power settings");
 }
 
+// ===== HID WHEEL =====
+/**
+ * Mouse with only a wheel. The wheel sits in a logical collection with a
+ * Resolution Multiplier feature, so hosts that support it (Windows, Linux)
+ * scroll in fractions of a detent.
+ */
+const uint8_t hidReportMap[] = {
+    0x05, 0x01,                      // Usage Page (Generic Desktop)
+    0x09, 0x02,                      // Usage (Mouse)
+    0xA1, 0x01,                      // Collection (Application)
+    0x09, 0x01,                      //   Usage (Pointer)
+    0xA1, 0x00,                      //   Collection (Physical)
+    0x85, HID_WHEEL_REPORT_ID,       //     Report ID
+    0x05, 0x09,                      //     Usage Page (Button)
+    0x19, 0x01,                      //     Usage Minimum (1)
+    0x29, 0x03,                      //     Usage Maximum (3)
+    0x15, 0x00,                      //     Logical Minimum (0)
+    0x25, 0x01,                      //     Logical Maximum (1)
+    0x95, 0x03,                      //     Report Count (3)
+    0x75, 0x01,                      //     Report Size (1)
+    0x81, 0x02,                      //     Input (Data, Var, Abs)
+    0x95, 0x01,                      //     Report Count (1)
+    0x75, 0x05,                      //     Report Size (5)
+    0x81, 0x03,                      //     Input (Const) padding
+    0x05, 0x01,                      //     Usage Page (Generic Desktop)
+    0x09, 0x30,                      //     Usage (X)
+    0x09, 0x31,                      //     Usage (Y)
+    0x15, 0x81,                      //     Logical Minimum (-127)
+    0x25, 0x7F,                      //     Logical Maximum (127)
+    0x75, 0x08,                      //     Report Size (8)
+    0x95, 0x02,                      //     Report Count (2)
+    0x81, 0x06,                      //     Input (Data, Var, Rel)
+    0xA1, 0x02,                      //     Collection (Logical)
+    0x85, HID_MULTIPLIER_REPORT_ID,  //       Report ID
+    0x09, 0x48,                      //       Usage (Resolution Multiplier)
+    0x15, 0x00,                      //       Logical Minimum (0)
+    0x25, 0x01,                      //       Logical Maximum (1)
+    0x35, 0x01,                      //       Physical Minimum (1)
+    0x45, ENCODER_COUNTS_PER_DETENT, //       Physical Maximum
+    0x75, 0x02,                      //       Report Size (2)
+    0x95, 0x01,                      //       Report Count (1)
+    0xB1, 0x02,                      //       Feature (Data, Var, Abs)
+    0x75, 0x06,                      //       Report Size (6)
+    0xB1, 0x03,                      //       Feature (Const) padding
+    0x85, HID_WHEEL_REPORT_ID,       //       Report ID
+    0x09, 0x38,                      //       Usage (Wheel)
+    0x35, 0x00,                      //       Physical Minimum (0)
+    0x45, 0x00,                      //       Physical Maximum (0)
+    0x15, 0x81,                      //       Logical Minimum (-127)
+    0x25, 0x7F,                      //       Logical Maximum (127)
+    0x75, 0x08,                      //       Report Size (8)
+    0x95, 0x01,                      //       Report Count (1)
+    0x81, 0x06,                      //       Input (Data, Var, Rel)
+    0xC0,                            //     End Collection
+    0xC0,                            //   End Collection
+    0xC0                             // End Collection
+};
+
+/**
+ * Host sets the multiplier feature to 1 when it wants high-resolution counts
+ */
+class MultiplierCallbacks : public BLECharacteristicCallbacks
+{
+  void onWrite(BLECharacteristic *pCharacteristic)
+  {
+    encoderReport.setHighResolution(pCharacteristic->getLength() > 0 && (pCharacteristic->getData()[0] & 0x03) != 0);
+    Serial.print("HID resolution multiplier: ");
+    Serial.println(encoderReport.highResolution() ? ENCODER_COUNTS_PER_DETENT : 1);
+  }
+};
+
+/**
+ * Add the HID, device information and battery services to the server
+ */
+void setupHidWheel()
+{
+  BLESecurity *pSecurity = new BLESecurity();
+  pSecurity->setAuthenticationMode(ESP_LE_AUTH_BOND);
+
+  hid = new BLEHIDDevice(pServer);
+  hid->manufacturer()->setValue("Tappie");
+  hid->pnp(0x02, 0xE502, 0xA111, 0x0210);
+  hid->hidInfo(0x00, 0x01);
+  hid->reportMap((uint8_t *)hidReportMap, sizeof(hidReportMap));
+
+  wheelInputReport = hid->inputReport(HID_WHEEL_REPORT_ID);
+  multiplierFeatureReport = hid->featureReport(HID_MULTIPLIER_REPORT_ID);
+  multiplierFeatureReport->setCallbacks(new MultiplierCallbacks());
+  uint8_t multiplier = 0;
+  multiplierFeatureReport->setValue(&multiplier, 1);
+
+  hid->setBatteryLevel(getBatteryLevel().toInt());
+  hid->startServices();
+
+  Serial.println("HID wheel ready");
+}
+
 // ===== ENCODER SETUP =====
 /**
  * Setup encoder and button with interrupts
@@ -332,84 +666,253 @@ void setupEncoder()
   encoder.clearCount();
   encoder.setFilter(1023); // Set filter to reduce noise
 
+  // Deep idle and light sleep pause PCNT and hand the first step to these
+  // interrupts, enabled only while paused
+  attachInterrupt(ENCODER_PIN_CLK, encoderClkISR, CHANGE);
+  attachInterrupt(ENCODER_PIN_DT, encoderDtISR, CHANGE);
+  gpio_intr_disable((gpio_num_t)ENCODER_PIN_CLK);
+  gpio_intr_disable((gpio_num_t)ENCODER_PIN_DT);
+
   // Configure button handlers for different actions
   encButton.attachClick([]()
                         {
     Serial.println("Button: Single click");
-    if (deviceConnected) sendNotification(encButtonChara, "single click"); });
+    if (bleLink.isConnected()) sendNotification(encButtonChara, "single click"); });
 
   encButton.attachDoubleClick([]()
                               {
     Serial.println("Button: Double click");
     
-    if (deviceConnected) sendNotification(encButtonChara, "double click"); });
+    if (bleLink.isConnected()) sendNotification(encButtonChara, "double click"); });
 
   encButton.attachMultiClick([]()
                               {
     Serial.println("Button: Multi click");
     
-    if (deviceConnected) sendNotification(encButtonChara, "multi click"); });
+    if (bleLink.isConnected()) sendNotification(encButtonChara, "multi click"); });
 
   encButton.attachLongPressStop([]()
                                 {
     Serial.println("Button: Long press");
     
-    if (deviceConnected) sendNotification(encButtonChara, "long press release"); });
+    if (bleLink.isConnected()) sendNotification(encButtonChara, "long press release"); });
 
   Serial.println("Encoder and button initialized with interrupts");
 }
 
-// ===== ENCODER RESET =====
+// ===== ENCODER DEEP IDLE =====
 /**
- * Reset encoder position and notify clients
+ * Read DT and CLK as a 2-bit quadrature state (DT is bit 1)
  */
-void resetEncoder()
+uint8_t readQuadState()
 {
-  encoder.clearCount();
-  prevEncPosition = 0;
-  currentEncPosition = 0;
-  Serial.println("Encoder count auto-reset after inactivity");
+  return (gpio_get_level((gpio_num_t)ENCODER_PIN_DT) << 1) | gpio_get_level((gpio_num_t)ENCODER_PIN_CLK);
+}
 
-  // Send reset notification to connected client
-  if (deviceConnected)
+/**
+ * Count change for a quadrature transition, matching the half-quad PCNT
+ * setup from attachHalfQuad(): only DT edges count, CLK sets the direction
+ */
+int quadStateDelta(uint8_t from, uint8_t to)
+{
+  uint8_t dt = (to >> 1) & 1;
+  uint8_t clk = to & 1;
+  if (((from ^ to) & 0b10) == 0)
+    return 0; // CLK-only change, PCNT would not count it either
+  return dt == clk ? -1 : 1;
+}
+
+/**
+ * Only DT's internal pull-up can be switched. CLK is on GPIO35 which, like
+ * the rest of GPIO34-39, has no internal pulls: its external pull-up stays
+ * powered, so CLK can always be read and a resting-low CLK still draws
+ * current through it in deep idle.
+ */
+void setDtPullup(bool enable)
+{
+  if (enable)
   {
-    String resetStr = "reset" + getBatteryLevel();
-    Serial.println(resetStr.c_str());
-    encPosChara->setValue(resetStr.c_str());
-    encPosChara->notify();
+    gpio_pullup_en((gpio_num_t)ENCODER_PIN_DT);
   }
+  else
+  {
+    gpio_pullup_dis((gpio_num_t)ENCODER_PIN_DT);
+  }
+}
 
-  // Update the activity timer
-  lastActivityTime = millis();
+/**
+ * Edge interrupts for a watched line, also used as its light sleep wake
+ */
+void watchEncoderLine(uint8_t pin)
+{
+  gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_ANYEDGE);
+  gpio_intr_enable((gpio_num_t)pin);
+}
+
+/**
+ * A watched line is away from where it was when PCNT was paused
+ */
+bool encoderMovedWhilePaused()
+{
+  uint8_t watched = encoderDtWatched ? 0b11 : 0b01;
+  return (readQuadState() & watched) != (idleQuadState & watched);
 }
 
 /**
- * Check and handle BLE connection state changes
+ * Leave the pause on the first edge of a watched line, with encoderIdleMux
+ * held. PCNT counts DT edges at the CLK level of the moment, so credit the
+ * DT edge it missed under CLK's new level if CLK moved first and DT after
+ * it, under the resting level otherwise. An unwatched DT can only have
+ * moved before the CLK edge that got us here. PCNT counts the rest.
  */
-void handleConnectionChanges()
+void resumeEncoder(bool clkMovedFirst)
 {
-  // Handle disconnection
-  if (!deviceConnected && oldDeviceConnected)
+  if (!encoderPaused)
+    return;
+
+  gpio_intr_disable((gpio_num_t)ENCODER_PIN_CLK);
+  gpio_intr_disable((gpio_num_t)ENCODER_PIN_DT);
+  if (!encoderDtWatched)
   {
-    delay(500); // Give BLE stack time to get ready
-    pServer->startAdvertising();
-    Serial.println("Restarting advertising");
-    oldDeviceConnected = deviceConnected;
+    setDtPullup(true);
+    delayMicroseconds(ENCODER_PULLUP_SETTLE_US);
   }
 
-  // Handle new connection
-  if (deviceConnected && !oldDeviceConnected)
+  uint8_t state = readQuadState();
+  uint8_t clkAtDtEdge = ((clkMovedFirst && encoderDtWatched) ? state : idleQuadState) & 0b01;
+  encoder.setCount(idleCount + quadStateDelta((idleQuadState & 0b10) | clkAtDtEdge, (state & 0b10) | clkAtDtEdge));
+  encoder.resumeCount();
+
+  if (state != idleQuadState)
   {
-    Serial.println("Client connected");
-    oldDeviceConnected = deviceConnected;
+    lastEncoderMoveTime = millis();
+    encoderWoke = true;
+  }
+  encoderPaused = false;
+  encoderDeepIdle = false;
+}
+
+void encoderClkISR()
+{
+  portENTER_CRITICAL_ISR(&encoderIdleMux);
+  resumeEncoder(true);
+  portEXIT_CRITICAL_ISR(&encoderIdleMux);
+}
+
+void encoderDtISR()
+{
+  portENTER_CRITICAL_ISR(&encoderIdleMux);
+  resumeEncoder(false);
+  portEXIT_CRITICAL_ISR(&encoderIdleMux);
+}
 
-    // When client connects, send current position
-    String encPositionStr = String(currentEncPosition);
-    String combinedStr = encPositionStr + getBatteryLevel();
-    Serial.println(combinedStr.c_str());
-    encPosChara->setValue(combinedStr.c_str());
-    encPosChara->notify();
+/**
+ * Stop PCNT and watch both lines for the first edge, with encoderIdleMux
+ * held. Used for deep idle and for light sleep, where PCNT is clock gated.
+ */
+void pauseEncoder()
+{
+  encoder.pauseCount();
+  idleCount = encoder.getCount();
+  idleQuadState = readQuadState();
+  encoderDtWatched = true;
+  encoderPaused = true;
+  watchEncoderLine(ENCODER_PIN_CLK);
+  watchEncoderLine(ENCODER_PIN_DT);
+
+  // A line may have moved between the snapshot and enabling its interrupt
+  if (encoderMovedWhilePaused())
+  {
+    resumeEncoder(false);
+  }
+}
+
+/**
+ * Pause PCNT after a long rest, or keep the pause light sleep already
+ * took. The DT pull-up is switched off only when DT rests low, where its
+ * closed contact would otherwise draw current the whole time. A floating
+ * DT cannot be watched, so it stops being an interrupt and wake source and
+ * CLK alone catches the first step.
+ */
+void enterEncoderDeepIdle()
+{
+  portENTER_CRITICAL(&encoderIdleMux);
+  if (!encoderPaused)
+  {
+    pauseEncoder();
   }
+  if (encoderPaused)
+  {
+    encoderDeepIdle = true;
+    if ((idleQuadState & 0b10) == 0)
+    {
+      gpio_intr_disable((gpio_num_t)ENCODER_PIN_DT);
+      if (encoderWakeArmed)
+      {
+        gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_DT);
+      }
+      encoderDtWatched = false;
+      setDtPullup(false);
+    }
+  }
+  portEXIT_CRITICAL(&encoderIdleMux);
+
+  Serial.println("Encoder entering deep idle");
+}
+
+// ===== ENCODER RESET =====
+/**
+ * Reset encoder position and notify clients
+ */
+void resetEncoder()
+{
+  // While PCNT is paused, resumeEncoder() restores idleCount, so zero that too
+  portENTER_CRITICAL(&encoderIdleMux);
+  encoder.clearCount();
+  if (encoderPaused)
+  {
+    idleCount = 0;
+  }
+  portEXIT_CRITICAL(&encoderIdleMux);
+  Serial.println("Encoder count auto-reset after inactivity");
+
+  // Send reset notification to connected client
+  encoderReport.reset(bleLink.isConnected(), millis());
+}
+
+// ===== INPUT ACTIVITY =====
+/**
+ * Record input so the connection can switch between active and idle parameters
+ */
+void noteInputActivity()
+{
+  lastInputTime = millis();
+}
+
+/**
+ * Time from resuming after a light sleep wake to the first debounced press
+ * or encoder step. The hardware wake-up before the CPU resumes is not
+ * included; measure that from the GPIO edge on a scope.
+ */
+void reportWakeLatency()
+{
+  if (wakeSource == NULL)
+    return;
+
+  Serial.printf("Wake latency (%s): %lld us after resume\n", wakeSource, esp_timer_get_time() - wakeTimeUs);
+  wakeSource = NULL;
+}
+
+/**
+ * Start the path to deep sleep: disconnect, deinit, then sleep
+ */
+void requestDeepSleep()
+{
+  Serial.println("Reed switch LOW - Entering deep sleep mode");
+
+  // Save state for wake-up
+  wasConnected = bleLink.isConnected();
+  bleLink.requestDeepSleep();
 }
 
 // Add this function before loop()
@@ -448,31 +951,26 @@ void setup()
     disableUnusedPeripherals();
   }
 
+  // Let PM handle CPU clock and light sleep in the ESP-IDF env
+  if (ENABLE_AUTO_LIGHT_SLEEP)
+  {
+    configurePowerManagement();
+  }
+
   // Setup hardware components
   setupEncoder();
   setupMediaButtons();
+  setupIdentity();
   setupBLE();
 
   Serial.println("Setup complete!");
 }
 
+/**
+ * Final step of requestDeepSleep(), BLE is already deinitialized
+ */
 void enterDeepSleep()
 {
-  Serial.println("Reed switch LOW - Entering deep sleep mode");
-
-  // Save state for wake-up
-  wasConnected = deviceConnected;
-
-  // Disconnect BLE if connected to prevent issues on wake
-  if (deviceConnected)
-  {
-    Serial.println("Disconnecting BLE before sleep");
-    pServer->disconnect(pServer->getConnId()); // Disconnect the client
-    // stop ble
-    BLEDevice::deinit(true); // Deinitialize BLE stack
-    // Client gets disconnected automatically when going to sleep
-  }
-
   // Configure wakeup on HIGH state of reed switch (bitmask format)
   uint64_t wakeupBitMask = 1ULL << reedSwitchPin;
   //esp_sleep_enable_ext1_wakeup(wakeupBitMask, ESP_EXT1_WAKEUP_ANY_HIGH);
@@ -486,53 +984,266 @@ void enterDeepSleep()
   // Code never reaches here - after waking, execution restarts at beginning of setup()
 }
 
+// ===== LIGHT SLEEP =====
+/**
+ * Light sleep is only taken when the BLE link can tolerate it
+ */
+bool lightSleepAllowed()
+{
+  return (ENABLE_LIGHT_SLEEP || ENABLE_AUTO_LIGHT_SLEEP) && (bleLink.state() == BLE_ADVERTISING || bleLink.state() == BLE_CONNECTED_IDLE);
+}
+
+/**
+ * Active (pressed) level of an input, including a latched wake press that
+ * may already have been released before the chip finished waking
+ */
+bool inputActive(int wakeIndex, uint8_t pin)
+{
+  if (wakeHoldUntil[wakeIndex] != 0)
+  {
+    if (millis() < wakeHoldUntil[wakeIndex])
+      return true;
+    wakeHoldUntil[wakeIndex] = 0;
+  }
+  return digitalRead(pin) == LOW;
+}
+
+/**
+ * Latch which input woke the chip so the first interaction is handled like
+ * any other. Levels are read straight away, before a short tap can end.
+ * Returns false if no input is away from its resting level.
+ */
+bool captureWakeEdge()
+{
+  wakeTimeUs = esp_timer_get_time();
+  wakeSource = NULL;
+
+  unsigned long holdUntil = millis() + WAKE_EDGE_HOLD_MS;
+  for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
+  {
+    if (gpio_get_level((gpio_num_t)mediaButtons[i].pin) == 0)
+    {
+      wakeHoldUntil[i] = holdUntil;
+      wakeSource = mediaButtons[i].name;
+    }
+  }
+  if (gpio_get_level((gpio_num_t)ENCODER_PIN_SW) == 0)
+  {
+    wakeHoldUntil[ENC_BUTTON_WAKE_INDEX] = holdUntil;
+    wakeSource = "encoder button";
+  }
+
+  // resumeEncoder() already counted the transition that woke us
+  if (encoderWoke)
+  {
+    encoderWoke = false;
+    wakeSource = "encoder";
+  }
+
+  return wakeSource != NULL;
+}
+
+/**
+ * Wake on any input leaving its resting level
+ */
+void armWakeSources()
+{
+  for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
+  {
+    gpio_wakeup_enable((gpio_num_t)mediaButtons[i].pin, GPIO_INTR_LOW_LEVEL);
+  }
+  gpio_wakeup_enable((gpio_num_t)ENCODER_PIN_SW, GPIO_INTR_LOW_LEVEL);
+
+  // PCNT is clock gated in light sleep, so pause it and wake when a watched
+  // encoder line leaves its resting level. The level interrupt runs the
+  // same ISR as an edge and resumes PCNT straight after the wake.
+  portENTER_CRITICAL(&encoderIdleMux);
+  encoderWoke = false;
+  if (!encoderPaused)
+  {
+    pauseEncoder();
+  }
+  encoderWakeArmed = encoderPaused;
+  if (encoderWakeArmed)
+  {
+    gpio_wakeup_enable((gpio_num_t)ENCODER_PIN_CLK, (idleQuadState & 0b01) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    if (encoderDtWatched)
+    {
+      gpio_wakeup_enable((gpio_num_t)ENCODER_PIN_DT, (idleQuadState & 0b10) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    }
+  }
+  portEXIT_CRITICAL(&encoderIdleMux);
+
+  esp_sleep_enable_gpio_wakeup();
+}
+
+void disarmWakeSources()
+{
+  for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
+  {
+    gpio_wakeup_disable((gpio_num_t)mediaButtons[i].pin);
+  }
+  gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_SW);
+
+  // Back to edge interrupts while deep idle goes on, otherwise PCNT was
+  // only paused for the sleep and runs again
+  portENTER_CRITICAL(&encoderIdleMux);
+  if (encoderWakeArmed)
+  {
+    gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_CLK);
+    gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_DT);
+    encoderWakeArmed = false;
+    if (encoderDeepIdle)
+    {
+      watchEncoderLine(ENCODER_PIN_CLK);
+      if (encoderDtWatched)
+      {
+        watchEncoderLine(ENCODER_PIN_DT);
+      }
+      if (encoderMovedWhilePaused())
+      {
+        resumeEncoder(false);
+      }
+    }
+    else
+    {
+      resumeEncoder(false);
+    }
+  }
+  portEXIT_CRITICAL(&encoderIdleMux);
+}
+
+/**
+ * Sleep until an input leaves its resting level or the housekeeping timer fires
+ */
+void enterLightSleep()
+{
+  armWakeSources();
+  esp_sleep_enable_timer_wakeup(LIGHT_SLEEP_MAX_US);
+
+  Serial.flush();
+  esp_light_sleep_start();
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO && !captureWakeEdge())
+  {
+    Serial.println("Woke from light sleep, input already released");
+  }
+  disarmWakeSources();
+}
+
+/**
+ * Let PM pick the CPU clock and light sleep in the idle task. Tickless
+ * idle only sleeps while inputPmLock is released, because PCNT
+ * stops in light sleep and must keep running while the knob is in use.
+ */
+void configurePowerManagement()
+{
+#if CONFIG_IDF_TARGET_ESP32C3
+  esp_pm_config_esp32c3_t pmConfig = {};
+#else
+  esp_pm_config_esp32_t pmConfig = {};
+#endif
+  pmConfig.max_freq_mhz = ACTIVE_CPU_FREQ;
+  pmConfig.min_freq_mhz = INACTIVE_CPU_FREQ;
+  pmConfig.light_sleep_enable = true;
+
+  esp_err_t err = esp_pm_configure(&pmConfig);
+  if (err != ESP_OK)
+  {
+    Serial.printf("Power management unavailable (%s)\n", esp_err_to_name(err));
+    return;
+  }
+
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "input", &inputPmLock);
+  esp_pm_lock_acquire(inputPmLock);
+  Serial.println("Auto light sleep enabled");
+}
+
+/**
+ * Idle: arm the wake sources and release the lock so the idle task can
+ * light sleep between loop iterations
+ */
+void armAutoLightSleep()
+{
+  if (autoLightSleepArmed || inputPmLock == NULL)
+    return;
+
+  armWakeSources();
+  autoLightSleepArmed = true;
+  esp_pm_lock_release(inputPmLock);
+}
+
+/**
+ * Called every loop while armed. An input away from its resting level is
+ * latched like a manual wake; any input or a busier BLE state takes the
+ * lock back so continuous sensing resumes.
+ */
+void checkAutoLightSleepWake()
+{
+  if (!autoLightSleepArmed)
+    return;
+
+  bool stillIdle = lightSleepAllowed() && millis() - lastInputTime > LIGHT_SLEEP_TIMEOUT;
+  if (!captureWakeEdge() && stillIdle)
+    return;
+
+  esp_pm_lock_acquire(inputPmLock);
+  autoLightSleepArmed = false;
+  disarmWakeSources();
+}
+
 // ===== MAIN LOOP =====
 void loop()
 {
   bool wasActive = false;
 
-  // Process button events
-  encButton.tick();
+  // Take back continuous sensing if an input woke us from auto light sleep
+  checkAutoLightSleepWake();
+
+  // Process button events, a latched wake press counts as pressed
+  encButton.tick(inputActive(ENC_BUTTON_WAKE_INDEX, ENCODER_PIN_SW));
+  bool buttonPressed = !encButton.isIdle();
 
   // Process media button events
   for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
   {
-    mediaButtons[i].button.tick();
+    mediaButtons[i].button.tick(inputActive(i, mediaButtons[i].pin));
+    buttonPressed |= !mediaButtons[i].button.isIdle();
   }
 
-  // Get current encoder position
-  currentEncPosition = encoder.getCount() / 2;
+  // OneButton leaves idle once the press is debounced, long before a click callback
+  if (buttonPressed)
+  {
+    reportWakeLatency();
+  }
 
-  // Handle encoder position changes
-  if (currentEncPosition != prevEncPosition)
+  // Notify position changes and feed the HID wheel from the current count
+  if (encoderReport.update(encoder.getCount(), millis(), bleLink.isConnected(), bleLink.connIntervalMs()))
   {
     wasActive = true;
-    
-
-    // Convert position to string and notify client
-    String encPositionStr = String(currentEncPosition);
-    String combinedStr = encPositionStr + getBatteryLevel();
-    Serial.println(combinedStr.c_str());
-    encPosChara->setValue(combinedStr.c_str());
-    encPosChara->notify();
+    noteInputActivity();
+    reportWakeLatency();
 
     Serial.print("Encoder position: ");
-    Serial.println(currentEncPosition);
+    Serial.println(encoderReport.position());
+    lastEncoderMoveTime = millis();
+  }
 
-    // Update previous position
-    prevEncPosition = currentEncPosition;
+  // Pause PCNT and switch off the DT pull-up after a long rest
+  if (!encoderDeepIdle && millis() - lastEncoderMoveTime > ENCODER_DEEP_IDLE_TIMEOUT)
+  {
+    enterEncoderDeepIdle();
   }
 
   // Auto-reset encoder after inactivity (only if not at zero)
-  if (millis() - lastActivityTime > AUTO_RESET_TIMEOUT && currentEncPosition != 0)
+  if (encoderReport.autoResetDue(millis()))
   {
     Serial.println("Auto-resetting encoder position due to inactivity");
     //Janky way to send battery level to the client but it works
     resetEncoder();
   }
 
-  // Handle BLE connection changes
-  handleConnectionChanges();
+  // Advance the BLE connection state machine
+  bleLink.update(millis(), lastInputTime);
 
   // Check reed switch state periodically
   if (millis() - lastReedCheckTime > REED_CHECK_INTERVAL)
@@ -546,7 +1257,7 @@ void loop()
     if (reedState == LOW && prevReedState == HIGH)
     {
       Serial.println("Reed switch changed to LOW, dont forget to uncomment the deep sleep line in the code");
-      //enterDeepSleep();           // Uncomment this line to enable deep sleep on reed switch LOW   REMEMBER TO UNCOMMENT YOU IDIOT AAAAA                     
+      //requestDeepSleep();           // Uncomment this line to enable deep sleep on reed switch LOW   REMEMBER TO UNCOMMENT YOU IDIOT AAAAA                     
     }
 
     prevReedState = reedState;
@@ -561,6 +1272,20 @@ void loop()
   // Power management based on activity
   unsigned long currentTime = millis();
 
+  // Light sleep once idle, the wake path latches the input that woke us
+  if (!wasActive && millis() - lastInputTime > LIGHT_SLEEP_TIMEOUT && lightSleepAllowed())
+  {
+    if (ENABLE_AUTO_LIGHT_SLEEP)
+    {
+      armAutoLightSleep(); // The idle task sleeps through the delay below
+    }
+    else
+    {
+      enterLightSleep();
+      return;
+    }
+  }
+
   // Much smaller delay to be more responsive when active, but still save power
   if (wasActive)
   {
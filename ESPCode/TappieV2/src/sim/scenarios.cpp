@@ -0,0 +1,280 @@
+/**
+ * TappieV2 - Simulated BLE fault scenarios (native build only)
+ *
+ * Runs the firmware's own BLE event path (BleLink and EncoderReport from
+ * ESPCode/lib/TappieLink, as used by both firmwares) against SimBLE with scripted knob
+ * movement and one injected fault per scenario, then reports what the host
+ * actually saw:
+ * - Delivered events, and notify() calls dropped before the host subscribed
+ * - Net step error (detents turned on the knob minus volume steps applied
+ *   by the PC app, which moves one step per changed position it receives)
+ * - The same for the HID wheel when built with -D ENABLE_HID_WHEEL=true
+ * - notify() to host latency percentiles
+ *
+ * Build and run with: pio run -e native-sim -t exec
+ */
+
+#include <BleLink.h>
+#include <EncoderReport.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// ===== BOARD =====
+#define ENC_POS_UUID "a9c8c7b4-fb55-4d27-99e4-2c14b5812546"
+#define WHEEL_REPORT_UUID "2a4d"
+#ifndef ENABLE_HID_WHEEL
+#define ENABLE_HID_WHEEL false // Same default as the firmware
+#endif
+#define ENCODER_COUNTS_PER_DETENT 2 // Half-quad PCNT, as on the board
+#define HID_WHEEL_DIRECTION 1
+#define BATTERY_LEVEL 57
+#define LOOP_PERIOD_MS 2
+
+// ===== SCRIPTED INPUT =====
+struct KnobMove
+{
+  uint32_t atMs;  // Time of the first detent
+  int detents;    // Signed number of detents
+  uint16_t gapMs; // Time between detents
+};
+
+// Slow turns, fast spins and reversals with pauses long enough to hit the auto-reset
+const KnobMove knobScript[] = {
+    {1500, 5, 120},
+    {3000, -3, 150},
+    {4000, 30, 15},
+    {5000, -30, 10},
+    {12000, 12, 40},
+    {13000, -4, 200},
+    {16000, 50, 8},
+    {17000, -20, 25},
+    {25000, 8, 60},
+};
+const int NUM_KNOB_MOVES = sizeof(knobScript) / sizeof(knobScript[0]);
+const uint32_t SCENARIO_LENGTH_MS = 30000;
+
+// ===== DEVICE =====
+/**
+ * The firmware's BLE side over SimBLE: the same BleLink and EncoderReport
+ * main.cpp uses, wired up the way setupBLE(), loop() and its link
+ * callbacks wire them. Only the PCNT count is modelled.
+ */
+class SimDevice : public BleLinkCallbacks
+{
+public:
+  explicit SimDevice(SimLink *link)
+      : server(link), encoderReport(ENCODER_COUNTS_PER_DETENT, HID_WHEEL_DIRECTION)
+  {
+    server.setCallbacks(&bleLink);
+
+    BLECharacteristic *encPosChara = server.createCharacteristic(ENC_POS_UUID);
+    encPosCccd.setCallbacks(bleLink.subscribeCallbacks());
+    encPosChara->addDescriptor(&encPosCccd);
+
+    BLECharacteristic *wheelReport = NULL;
+    if (ENABLE_HID_WHEEL)
+    {
+      wheelReport = server.createCharacteristic(WHEEL_REPORT_UUID);
+      wheelReport->addDescriptor(&wheelCccd);
+    }
+
+    encoderReport.setBatteryLevel(BATTERY_LEVEL);
+    encoderReport.begin(encPosChara, wheelReport);
+    bleLink.begin(&server, this, link->now());
+  }
+
+  void onLinkConnected() override { resetEncoder(); }
+  void onLinkReady() override { encoderReport.sendPosition(); }
+  void onLinkDisconnected() override { encoderReport.setHighResolution(false); }
+
+  void resetEncoder()
+  {
+    encoderCount = 0;
+    encoderReport.reset(bleLink.isConnected(), now);
+  }
+
+  void loop(uint32_t nowMs)
+  {
+    now = nowMs;
+
+    if (encoderReport.update(encoderCount, now, bleLink.isConnected(), bleLink.connIntervalMs()))
+    {
+      lastInputTime = now;
+    }
+
+    if (encoderReport.autoResetDue(now))
+    {
+      resetEncoder();
+    }
+
+    bleLink.update(now, lastInputTime);
+  }
+
+  int64_t encoderCount = 0; // Counted by PCNT, so it keeps moving while loop() is blocked
+
+private:
+  BLEServer server;
+  BLE2902 encPosCccd;
+  BLE2902 wheelCccd;
+  BleLink bleLink;
+  EncoderReport encoderReport;
+  uint32_t lastInputTime = 0;
+  uint32_t now = 0;
+};
+
+// ===== HOST MODEL =====
+/**
+ * Mirrors TappieController.handle_encoder_position() in the PC app
+ */
+int applyHostSteps(const std::vector<SimDelivery> &deliveries)
+{
+  int prevPosition = 0;
+  int steps = 0;
+  for (const SimDelivery &delivery : deliveries)
+  {
+    if (delivery.uuid != ENC_POS_UUID)
+      continue;
+
+    std::string position = delivery.value.substr(0, delivery.value.find(' '));
+    if (position == "reset")
+    {
+      prevPosition = 0;
+      continue;
+    }
+
+    int currentPosition = atoi(position.c_str());
+    if (currentPosition > prevPosition)
+      steps++;
+    else if (currentPosition < prevPosition)
+      steps--;
+    prevPosition = currentPosition;
+  }
+  return steps;
+}
+
+/**
+ * Detents the OS scrolled from the wheel reports, without the resolution
+ * multiplier (the sim host never enables it)
+ */
+int applyHostWheel(const std::vector<SimDelivery> &deliveries)
+{
+  int detents = 0;
+  for (const SimDelivery &delivery : deliveries)
+  {
+    if (delivery.uuid == WHEEL_REPORT_UUID && delivery.value.size() >= 4)
+    {
+      detents += (int8_t)delivery.value[3] * HID_WHEEL_DIRECTION;
+    }
+  }
+  return detents;
+}
+
+uint32_t percentile(std::vector<uint32_t> &values, int pct)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  size_t index = (values.size() - 1) * pct / 100;
+  return values[index];
+}
+
+// ===== SCENARIOS =====
+struct Scenario
+{
+  const char *name;
+  SimFaults faults;
+};
+
+SimFaults makeFaults(void (*configure)(SimFaults &))
+{
+  SimFaults faults;
+  configure(faults);
+  return faults;
+}
+
+void runScenario(const Scenario &scenario)
+{
+  SimLink link(scenario.faults, 0x7A991E);
+  SimDevice device(&link);
+
+  int knobDetents = 0;
+  for (uint32_t t = 0; t < SCENARIO_LENGTH_MS; t++)
+  {
+    for (int i = 0; i < NUM_KNOB_MOVES; i++)
+    {
+      const KnobMove &move = knobScript[i];
+      int count = abs(move.detents);
+      if (t < move.atMs || (t - move.atMs) % move.gapMs != 0 || (int)((t - move.atMs) / move.gapMs) >= count)
+        continue;
+      int direction = move.detents > 0 ? 1 : -1;
+      device.encoderCount += direction * ENCODER_COUNTS_PER_DETENT;
+      knobDetents += direction;
+    }
+
+    if (t % LOOP_PERIOD_MS == 0)
+    {
+      device.loop(link.now());
+    }
+    link.advance(1);
+  }
+
+  std::vector<uint32_t> latencies;
+  for (const SimDelivery &delivery : link.deliveries())
+  {
+    latencies.push_back(delivery.deliveredAtMs - delivery.queuedAtMs);
+  }
+
+  const SimStats &stats = link.stats();
+  int hostSteps = applyHostSteps(link.deliveries());
+  char wheelError[8] = "-";
+  if (ENABLE_HID_WHEEL)
+  {
+    snprintf(wheelError, sizeof(wheelError), "%+d", knobDetents - applyHostWheel(link.deliveries()));
+  }
+  printf("%-18s %6u %6u %6u %6u %6u %6u %+7d %7s %5u %5u %5u %5u\n",
+         scenario.name,
+         stats.notifyCalls,
+         stats.delivered,
+         stats.notifyDisabled,
+         stats.txBufferFull,
+         stats.lost + stats.droppedOnDisconnect,
+         stats.connParamRejects,
+         knobDetents - hostSteps,
+         wheelError,
+         percentile(latencies, 50),
+         percentile(latencies, 95),
+         percentile(latencies, 99),
+         stats.disconnects);
+}
+
+int main()
+{
+  const Scenario scenarios[] = {
+      {"baseline", makeFaults([](SimFaults &f) {})},
+      {"tx-congestion", makeFaults([](SimFaults &f)
+                                   { f.txBufferSlots = 2; f.packetsPerEvent = 1; f.connIntervalMs = 100; })},
+      {"slow-host", makeFaults([](SimFaults &f)
+                               { f.latencyMinMs = 50; f.latencyMaxMs = 400; })},
+      {"packet-loss", makeFaults([](SimFaults &f)
+                                 { f.lossPercent = 10; })},
+      {"conn-param-reject", makeFaults([](SimFaults &f)
+                                       { f.connParamRejectPercent = 100; f.connIntervalMs = 7; })},
+      {"disconnects", makeFaults([](SimFaults &f)
+                                 { f.disconnectEveryMs = 4000; f.reconnectDelayMs = 800; })},
+      {"late-subscribe", makeFaults([](SimFaults &f)
+                                    { f.subscribeDelayMs = 2500; })},
+      {"no-subscribe", makeFaults([](SimFaults &f)
+                                  { f.subscribeDelayMs = 0; })},
+  };
+
+  printf("%-18s %6s %6s %6s %6s %6s %6s %7s %7s %5s %5s %5s %5s\n",
+         "scenario", "notify", "deliv", "nosub", "txfull", "lost", "cprej", "steperr", "wheelerr", "p50", "p95", "p99", "disc");
+  for (const Scenario &scenario : scenarios)
+  {
+    runScenario(scenario);
+  }
+  return 0;
+}
@@ -16,11 +16,16 @@
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#include <Preferences.h>
 #include <AiEsp32RotaryEncoder.h>
 #include <OneButton.h>
 #include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
+#include <esp_mac.h>
 #include <driver/periph_ctrl.h>
 #include <driver/adc.h>
+#include <BleLink.h>
 
 // ===== PIN DEFINITIONS =====
 const uint8_t ENCODER_PIN_DT = 1;
@@ -39,12 +44,17 @@ gpio_num_t reedSwitchPin = GPIO_NUM_5; // GPIO pin for reed switch
 #define BATTERY_PIN 3 // GPIO pin for battery level measurement
 
 // ===== BLE DEFINITIONS =====
-#define BLE_DEVICE_NAME "TappieV2"
+#define BLE_DEVICE_NAME "TappieV2" // Prefix, the device ID is appended as "-XXXX"
 #define SERVICE_UUID "738b66f1-91b7-4f25-8ab8-31d38d56541a"
 #define ENC_POS_UUID "a9c8c7b4-fb55-4d27-99e4-2c14b5812546"
 #define ENC_BUTTON_UUID "0c2f5fbe-c20f-49ec-8c7c-ce0c9358e574"
 #define MEDIA_SINGLEBUTTON_UUID "9ff67916-665f-4489-b257-46d118b1e5eb"
 #define MEDIA_DOUBLEBUTTON_UUID "66f1ab02-c93d-44fe-8ca9-5e8bdbb2fe80"
+#define IDENTITY_UUID "a565235a-f53e-40c5-99a3-2aba054e033f"
+
+// ===== DEVICE IDENTITY =====
+#define MANUFACTURER_ID 0xFFFF // Bluetooth SIG ID reserved for testing/unassigned use
+#define IDENTITY_NVS_NAMESPACE "tappie"
 
 // ===== TIMING CONSTANTS =====
 #define AUTO_RESET_TIMEOUT 5000       // 5 seconds in milliseconds
@@ -53,6 +63,14 @@ gpio_num_t reedSwitchPin = GPIO_NUM_5; // GPIO pin for reed switch
 
 // ===== POWER MANAGEMENT CONSTANTS =====
 #define LIGHT_SLEEP_TIMEOUT 10000  // 10 seconds of inactivity before light sleep
+#ifndef ENABLE_LIGHT_SLEEP
+#define ENABLE_LIGHT_SLEEP false   // Manual light sleep from loop(), no env sets it; needs BLE modem sleep
+#endif
+#ifndef ENABLE_AUTO_LIGHT_SLEEP
+#define ENABLE_AUTO_LIGHT_SLEEP false // PM auto light sleep, needs the ESP-IDF env's sdkconfig
+#endif
+#define LIGHT_SLEEP_MAX_US 500000  // Wake for housekeeping at least every 500ms
+#define WAKE_EDGE_HOLD_MS 60       // Hold a latched wake press past OneButton's 50ms debounce
 #define INACTIVE_CPU_FREQ 40       // CPU MHz when inactive
 #define ACTIVE_CPU_FREQ 80         // CPU MHz when active
 #define BLE_MIN_CONN_INTERVAL 0x40 // 80ms (was 0x20 = 40ms)
@@ -83,6 +101,13 @@ BLECharacteristic *encPosChara = NULL;
 BLECharacteristic *encButtonChara = NULL;
 BLECharacteristic *mediaButtonChara = NULL;
 BLECharacteristic *mediaDoubleButtonChara = NULL;
+BLECharacteristic *identityChara = NULL;
+
+// Per-device identity, advertised in the name and manufacturer data
+Preferences preferences;
+uint32_t deviceId = 0; // Low 32 bits of the efuse MAC unless overridden in NVS
+uint8_t deviceRole = 0; // Host-assigned role, stored in NVS
+char deviceName[20];
 
 // Media buttons array
 MediaButton mediaButtons[] = {
@@ -93,13 +118,25 @@ MediaButton mediaButtons[] = {
     {"Master", MasterButtonPin, OneButton(MasterButtonPin, true, true)}};
 const int NUM_MEDIA_BUTTONS = sizeof(mediaButtons) / sizeof(mediaButtons[0]);
 
+// Connection lifecycle, shared with TappieV2 and the native sim
+BleLink bleLink;
+
 // ===== STATE VARIABLES =====
-bool deviceConnected = false;
-bool oldDeviceConnected = false;
 
-// Encoder position tracking
-int prevEncPosition = 0;
-int currentEncPosition = 0;
+unsigned long lastInputTime = 0;
+
+// Wake edge latch: which input woke us from light sleep and when
+#define ENC_BUTTON_WAKE_INDEX NUM_MEDIA_BUTTONS
+unsigned long wakeHoldUntil[NUM_MEDIA_BUTTONS + 1] = {0};
+int64_t wakeTimeUs = 0;
+const char *wakeSource = NULL; // Set until the first debounced press or encoder step after the wake
+volatile bool encoderWakeArmed = false; // Encoder lines are level wake sources instead of edge interrupts
+volatile bool encoderWoke = false;      // readEncoderISR() decoded a waking encoder transition
+portMUX_TYPE encoderWakeMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Auto light sleep: PM lock held while the knob is in use
+esp_pm_lock_handle_t inputPmLock = NULL;
+bool autoLightSleepArmed = false;
 
 int lastStateCLK;
 int currentStateCLK;
@@ -115,21 +152,29 @@ unsigned long lastReedCheckTime = 0;
 
 // ===== FUNCTION DECLARATIONS =====
 void setupBLE();
+void setupIdentity();
+void formatDeviceName();
+void configureAdvertising();
 void setupEncoder();
 void setupMediaButtons();
 void resetEncoder();
-void handleConnectionChanges();
+void noteInputActivity();
+void reportWakeLatency();
+void sendCurrentPosition();
+void requestDeepSleep();
+void configurePowerManagement();
 String getBatteryLevel();
 void enterDeepSleep();
 void sendNotification(BLECharacteristic *characteristic, const char *value);
-class MyServerCallbacks;
 
 /**
  * Helper function to send BLE notifications with auto-reset
  */
 void sendNotification(BLECharacteristic *characteristic, const char *value)
 {
-  if (!deviceConnected)
+  noteInputActivity();
+
+  if (!bleLink.isConnected())
     return;
 
   characteristic->setValue(value);
@@ -153,7 +198,7 @@ void buttonClickCallback(void *parameter)
   Serial.print("Button clicked: ");
   Serial.println(buttonName);
 
-  if (deviceConnected)
+  if (bleLink.isConnected())
   {
     sendNotification(mediaButtonChara, buttonName);
   }
@@ -167,7 +212,7 @@ void buttonDoubleClickCallback(void *parameter)
   Serial.print("Button double clicked: ");
   Serial.println(buttonName);
 
-  if (deviceConnected)
+  if (bleLink.isConnected())
   {
     sendNotification(mediaDoubleButtonChara, buttonName);
   }
@@ -179,9 +224,11 @@ void encoderRotaryLoop()
   if (rotaryEncoder.encoderChanged() && millis() - lastTimeTurned > 50)
   {
     lastTimeTurned = millis();
+    noteInputActivity();
+    reportWakeLatency();
     String positionStr = String(rotaryEncoder.readEncoder() + getBatteryLevel());
     Serial.println(positionStr.c_str());
-    if (deviceConnected)
+    if (bleLink.isConnected())
     {
       encPosChara->setValue(positionStr.c_str());
       encPosChara->notify();
@@ -189,9 +236,36 @@ void encoderRotaryLoop()
   }
 }
 
+/**
+ * Put the encoder lines back on the CHANGE interrupts the rotary encoder
+ * library attached, after gpio_wakeup_enable() switched them to levels
+ */
+void restoreEncoderEdgeInterrupts()
+{
+  encoderWakeArmed = false;
+  gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_CLK);
+  gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_DT);
+  gpio_set_intr_type((gpio_num_t)ENCODER_PIN_CLK, GPIO_INTR_ANYEDGE);
+  gpio_set_intr_type((gpio_num_t)ENCODER_PIN_DT, GPIO_INTR_ANYEDGE);
+}
+
+/**
+ * Edge interrupt from either encoder line. While the lines are armed as
+ * light sleep wake sources this is the level interrupt that woke the chip:
+ * the library decodes the waking transition against the state it saw last,
+ * then the lines go back to edges for the rest of the turn.
+ */
 void IRAM_ATTR readEncoderISR()
 {
   rotaryEncoder.readEncoder_ISR();
+
+  portENTER_CRITICAL_ISR(&encoderWakeMux);
+  if (encoderWakeArmed)
+  {
+    restoreEncoderEdgeInterrupts();
+    encoderWoke = true;
+  }
+  portEXIT_CRITICAL_ISR(&encoderWakeMux);
 }
 
 /**
@@ -261,32 +335,157 @@ void disableUnusedPeripherals()
   Serial.println("Unused peripherals disabled for power saving");
 }
 
-class MyServerCallbacks : public BLEServerCallbacks
+// ===== DEVICE IDENTITY =====
+/**
+ * Derive the device ID from the efuse MAC, then apply any ID or role
+ * stored in NVS so several knobs can be told apart by one host
+ */
+void formatDeviceName()
+{
+  snprintf(deviceName, sizeof(deviceName), "%s-%04X", BLE_DEVICE_NAME, (unsigned int)(deviceId & 0xFFFF));
+}
+
+void setupIdentity()
+{
+  uint8_t mac[6];
+  esp_efuse_mac_get_default(mac);
+  uint32_t macId = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+
+  preferences.begin(IDENTITY_NVS_NAMESPACE, false);
+  deviceId = preferences.getULong("id", macId);
+  deviceRole = preferences.getUChar("role", 0);
+
+  formatDeviceName();
+  Serial.printf("Device ID %08X, role %u, name %s\n", (unsigned int)deviceId, deviceRole, deviceName);
+}
+
+String getIdentityString()
+{
+  char identity[16];
+  snprintf(identity, sizeof(identity), "%08X %u", (unsigned int)deviceId, deviceRole);
+  return String(identity);
+}
+
+/**
+ * Advertising payload: flags, the service UUID and manufacturer data
+ * carrying the device ID and role, so hosts can filter at scan time.
+ * The name goes in the scan response.
+ */
+void configureAdvertising()
+{
+  std::string manufacturerData;
+  manufacturerData += (char)(MANUFACTURER_ID & 0xFF);
+  manufacturerData += (char)(MANUFACTURER_ID >> 8);
+  manufacturerData += (char)(deviceId >> 24);
+  manufacturerData += (char)(deviceId >> 16);
+  manufacturerData += (char)(deviceId >> 8);
+  manufacturerData += (char)(deviceId);
+  manufacturerData += (char)deviceRole;
+
+  BLEAdvertisementData advertisementData;
+  advertisementData.setFlags(ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
+  advertisementData.setCompleteServices(BLEUUID(SERVICE_UUID));
+  advertisementData.setManufacturerData(manufacturerData);
+
+  BLEAdvertisementData scanResponseData;
+  scanResponseData.setName(deviceName);
+
+  BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+  pAdvertising->setAdvertisementData(advertisementData);
+  pAdvertising->setScanResponseData(scanResponseData);
+}
+
+/**
+ * Parse all of text as an unsigned number no larger than max
+ */
+bool parseIdentityValue(const String &text, int base, uint32_t max, uint32_t *value)
+{
+  if (text.length() == 0 || text.length() > 8 || !isxdigit(text[0]))
+    return false;
+
+  char *end;
+  unsigned long parsed = strtoul(text.c_str(), &end, base);
+  if (*end != '\0' || parsed > max)
+    return false;
+
+  *value = parsed;
+  return true;
+}
+
+/**
+ * Host writes "role=<0-255>" or "id=<1-8 hex digits>" to reassign this knob.
+ * Stored in NVS and advertised from the next advertising start, the GAP
+ * name follows a new ID straight away. Anything else is rejected and the
+ * characteristic reads back the unchanged identity.
+ */
+class IdentityCallbacks : public BLECharacteristicCallbacks
+{
+  void onWrite(BLECharacteristic *pCharacteristic)
+  {
+    String value = pCharacteristic->getValue().c_str();
+    uint32_t parsed = 0;
+
+    if (value.startsWith("role=") && parseIdentityValue(value.substring(5), 10, 255, &parsed))
+    {
+      deviceRole = (uint8_t)parsed;
+      preferences.putUChar("role", deviceRole);
+    }
+    else if (value.startsWith("id=") && parseIdentityValue(value.substring(3), 16, 0xFFFFFFFF, &parsed))
+    {
+      deviceId = parsed;
+      preferences.putULong("id", deviceId);
+      formatDeviceName();
+      esp_ble_gap_set_device_name(deviceName);
+    }
+    else
+    {
+      Serial.print("Rejected identity command: ");
+      Serial.println(value);
+      pCharacteristic->setValue(getIdentityString().c_str());
+      return;
+    }
+
+    Serial.print("Identity updated: ");
+    Serial.println(getIdentityString());
+    pCharacteristic->setValue(getIdentityString().c_str());
+    configureAdvertising();
+  }
+};
+
+/**
+ * What the firmware does as bleLink moves through the connection lifecycle
+ */
+class TappieLinkCallbacks : public BleLinkCallbacks
 {
-  void onConnect(BLEServer *pServer)
+  void onLinkConnected()
   {
-    deviceConnected = true;
-    Serial.println("Device connected");
     resetEncoder(); // Reset encoder position on new connection
   }
 
-  void onDisconnect(BLEServer *pServer)
+  void onLinkReady()
   {
-    deviceConnected = false;
-    Serial.println("Device disconnected");
+    sendCurrentPosition();
+  }
+
+  void onLinkDeinit()
+  {
+    BLEDevice::deinit(true);
+    enterDeepSleep();
   }
 };
 
+TappieLinkCallbacks linkCallbacks;
+
 // Modify setupBLE() to optimize BLE parameters
 void setupBLE()
 {
   // Create the BLE Device
-  BLEDevice::init(BLE_DEVICE_NAME);
+  BLEDevice::init(deviceName);
   BLEDevice::setPower(ESP_PWR_LVL_N12);
 
   // Create the BLE Server
   pServer = BLEDevice::createServer();
-  pServer->setCallbacks(new MyServerCallbacks());
+  pServer->setCallbacks(&bleLink);
 
   // Create the BLE Service
   BLEService *pService = pServer->createService(SERVICE_UUID);
@@ -316,8 +515,16 @@ void setupBLE()
           BLECharacteristic::PROPERTY_WRITE |
           BLECharacteristic::PROPERTY_NOTIFY);
 
+  identityChara = pService->createCharacteristic(
+      IDENTITY_UUID,
+      BLECharacteristic::PROPERTY_READ |
+          BLECharacteristic::PROPERTY_WRITE);
+  identityChara->setCallbacks(new IdentityCallbacks());
+
   // Add descriptor and set initial values
-  encPosChara->addDescriptor(new BLE2902());
+  BLE2902 *encPosCccd = new BLE2902();
+  encPosCccd->setCallbacks(bleLink.subscribeCallbacks());
+  encPosChara->addDescriptor(encPosCccd);
   encButtonChara->addDescriptor(new BLE2902());
   mediaButtonChara->addDescriptor(new BLE2902());
   mediaDoubleButtonChara->addDescriptor(new BLE2902());
@@ -326,17 +533,17 @@ void setupBLE()
   encButtonChara->setValue("0");
   mediaButtonChara->setValue("Master");
   mediaDoubleButtonChara->setValue("0");
+  identityChara->setValue(getIdentityString().c_str());
 
   // Start the service
   pService->start();
 
   // Configure and start advertising
   BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
-  pAdvertising->addServiceUUID(SERVICE_UUID);
-  pAdvertising->setScanResponse(true);
+  configureAdvertising();
   pAdvertising->setMinInterval(BLE_MIN_CONN_INTERVAL); // Increased interval (80ms)
   pAdvertising->setMaxInterval(BLE_MAX_CONN_INTERVAL); // Increased interval (160ms)
-  BLEDevice::startAdvertising();
+  bleLink.begin(pServer, &linkCallbacks, millis());
 
   Serial.println("BLE server ready with optimized power settings");
 }
@@ -356,25 +563,25 @@ void setupEncoder()
   encButton.attachClick([]()
                         {
      Serial.println("Button: Single click");
-     if (deviceConnected) sendNotification(encButtonChara, "single click"); });
+     if (bleLink.isConnected()) sendNotification(encButtonChara, "single click"); });
 
   encButton.attachDoubleClick([]()
                               {
      Serial.println("Button: Double click");
      
-     if (deviceConnected) sendNotification(encButtonChara, "double click"); });
+     if (bleLink.isConnected()) sendNotification(encButtonChara, "double click"); });
 
   encButton.attachMultiClick([]()
                              {
      Serial.println("Button: Multi click");
      
-     if (deviceConnected) sendNotification(encButtonChara, "multi click"); });
+     if (bleLink.isConnected()) sendNotification(encButtonChara, "multi click"); });
 
   encButton.attachLongPressStop([]()
                                 {
      Serial.println("Button: Long press");
      
-     if (deviceConnected) sendNotification(encButtonChara, "long press release"); });
+     if (bleLink.isConnected()) sendNotification(encButtonChara, "long press release"); });
 
   Serial.println("Encoder and button initialized with interrupts");
 }
@@ -388,7 +595,7 @@ void resetEncoder()
   Serial.println("Encoder count auto-reset after inactivity");
 
   // Send reset notification to connected client
-  if (deviceConnected)
+  if (bleLink.isConnected())
   {
     rotaryEncoder.reset(0);
     String resetStr = "reset" + getBatteryLevel();
@@ -407,33 +614,51 @@ volatile uint8_t encoderState = 0;        // Current quadrature state
 volatile bool fullDetentRotation = false; // Flag to indicate a complete detent rotation
 
 
+// ===== INPUT ACTIVITY =====
 /**
- * Check and handle BLE connection state changes
+ * Record input so the connection can switch between active and idle parameters
  */
-void handleConnectionChanges()
+void noteInputActivity()
 {
-  // Handle disconnection
-  if (!deviceConnected && oldDeviceConnected)
-  {
-    delay(500); // Give BLE stack time to get ready
-    pServer->startAdvertising();
-    Serial.println("Restarting advertising");
-    oldDeviceConnected = deviceConnected;
-  }
+  lastInputTime = millis();
+}
 
-  // Handle new connection
-  if (deviceConnected && !oldDeviceConnected)
-  {
-    Serial.println("Client connected");
-    oldDeviceConnected = deviceConnected;
-
-    // When client connects, send current position
-    String encPositionStr = String(currentEncPosition);
-    String combinedStr = encPositionStr + getBatteryLevel();
-    Serial.println(combinedStr.c_str());
-    encPosChara->setValue(combinedStr.c_str());
-    encPosChara->notify();
-  }
+/**
+ * Time from resuming after a light sleep wake to the first debounced press
+ * or encoder step. The hardware wake-up before the CPU resumes is not
+ * included; measure that from the GPIO edge on a scope.
+ */
+void reportWakeLatency()
+{
+  if (wakeSource == NULL)
+    return;
+
+  Serial.printf("Wake latency (%s): %lld us after resume\n", wakeSource, esp_timer_get_time() - wakeTimeUs);
+  wakeSource = NULL;
+}
+
+/**
+ * Send the current position, used once the host is listening
+ */
+void sendCurrentPosition()
+{
+  String encPositionStr = String(rotaryEncoder.readEncoder());
+  String combinedStr = encPositionStr + getBatteryLevel();
+  Serial.println(combinedStr.c_str());
+  encPosChara->setValue(combinedStr.c_str());
+  encPosChara->notify();
+}
+
+/**
+ * Start the path to deep sleep: disconnect, deinit, then sleep
+ */
+void requestDeepSleep()
+{
+  Serial.println("Reed switch LOW - Entering deep sleep mode");
+
+  // Save state for wake-up
+  wasConnected = bleLink.isConnected();
+  bleLink.requestDeepSleep();
 }
 
 // Add this function before loop()
@@ -462,32 +687,27 @@ void setup()
   //   disableUnusedPeripherals();
   // }
 
+  // Let PM handle CPU clock and light sleep in the ESP-IDF env
+  if (ENABLE_AUTO_LIGHT_SLEEP)
+  {
+    configurePowerManagement();
+  }
+
   // Setup hardware components
   setupEncoder();
   setupMediaButtons();
+  setupIdentity();
   setupBLE();
 
   Serial.println("Setup complete!");
   // digitalWrite(1, HIGH); // Set reed switch pin to HIGH to avoid false trigger
 }
 
+/**
+ * Final step of requestDeepSleep(), BLE is already deinitialized
+ */
 void enterDeepSleep()
 {
-  Serial.println("Reed switch LOW - Entering deep sleep mode");
-
-  // Save state for wake-up
-  wasConnected = deviceConnected;
-
-  // Disconnect BLE if connected to prevent issues on wake
-  if (deviceConnected)
-  {
-    Serial.println("Disconnecting BLE before sleep");
-    pServer->disconnect(pServer->getConnId()); // Disconnect the client
-    // stop ble
-    BLEDevice::deinit(true); // Deinitialize BLE stack
-    // Client gets disconnected automatically when going to sleep
-  }
-
   // Configure wakeup on HIGH state of reed switch (bitmask format)
   uint64_t wakeupBitMask = 1ULL << reedSwitchPin;
   // esp_sleep_enable_ext1_wakeup(wakeupBitMask, ESP_EXT1_WAKEUP_ANY_HIGH);
@@ -501,21 +721,208 @@ void enterDeepSleep()
   // Code never reaches here - after waking, execution restarts at beginning of setup()
 }
 
+// ===== LIGHT SLEEP =====
+/**
+ * Light sleep is only taken when the BLE link can tolerate it
+ */
+bool lightSleepAllowed()
+{
+  return (ENABLE_LIGHT_SLEEP || ENABLE_AUTO_LIGHT_SLEEP) && (bleLink.state() == BLE_ADVERTISING || bleLink.state() == BLE_CONNECTED_IDLE);
+}
+
+/**
+ * Active (pressed) level of an input, including a latched wake press that
+ * may already have been released before the chip finished waking
+ */
+bool inputActive(int wakeIndex, uint8_t pin)
+{
+  if (wakeHoldUntil[wakeIndex] != 0)
+  {
+    if (millis() < wakeHoldUntil[wakeIndex])
+      return true;
+    wakeHoldUntil[wakeIndex] = 0;
+  }
+  return digitalRead(pin) == LOW;
+}
+
+/**
+ * Latch which input woke the chip so the first interaction is handled like
+ * any other. Levels are read straight away, before a short tap can end.
+ * Returns false if no input is away from its resting level.
+ */
+bool captureWakeEdge()
+{
+  wakeTimeUs = esp_timer_get_time();
+  wakeSource = NULL;
+
+  unsigned long holdUntil = millis() + WAKE_EDGE_HOLD_MS;
+  for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
+  {
+    if (gpio_get_level((gpio_num_t)mediaButtons[i].pin) == 0)
+    {
+      wakeHoldUntil[i] = holdUntil;
+      wakeSource = mediaButtons[i].name;
+    }
+  }
+  if (gpio_get_level((gpio_num_t)ENCODER_PIN_SW) == 0)
+  {
+    wakeHoldUntil[ENC_BUTTON_WAKE_INDEX] = holdUntil;
+    wakeSource = "encoder button";
+  }
+
+  // readEncoderISR() already counted the transition that woke us
+  if (encoderWoke)
+  {
+    encoderWoke = false;
+    wakeSource = "encoder";
+  }
+
+  return wakeSource != NULL;
+}
+
+/**
+ * Wake on any input leaving its resting level
+ */
+void armWakeSources()
+{
+  for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
+  {
+    gpio_wakeup_enable((gpio_num_t)mediaButtons[i].pin, GPIO_INTR_LOW_LEVEL);
+  }
+  gpio_wakeup_enable((gpio_num_t)ENCODER_PIN_SW, GPIO_INTR_LOW_LEVEL);
+
+  // Edge interrupts do not fire in light sleep, so wake when either encoder
+  // line leaves its resting level; readEncoderISR() takes it from there
+  portENTER_CRITICAL(&encoderWakeMux);
+  encoderWoke = false;
+  encoderWakeArmed = true;
+  gpio_wakeup_enable((gpio_num_t)ENCODER_PIN_CLK, gpio_get_level((gpio_num_t)ENCODER_PIN_CLK) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  gpio_wakeup_enable((gpio_num_t)ENCODER_PIN_DT, gpio_get_level((gpio_num_t)ENCODER_PIN_DT) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  portEXIT_CRITICAL(&encoderWakeMux);
+
+  esp_sleep_enable_gpio_wakeup();
+}
+
+void disarmWakeSources()
+{
+  for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
+  {
+    gpio_wakeup_disable((gpio_num_t)mediaButtons[i].pin);
+  }
+  gpio_wakeup_disable((gpio_num_t)ENCODER_PIN_SW);
+
+  portENTER_CRITICAL(&encoderWakeMux);
+  if (encoderWakeArmed)
+  {
+    restoreEncoderEdgeInterrupts();
+  }
+  portEXIT_CRITICAL(&encoderWakeMux);
+}
+
+/**
+ * Sleep until an input leaves its resting level or the housekeeping timer fires
+ */
+void enterLightSleep()
+{
+  armWakeSources();
+  esp_sleep_enable_timer_wakeup(LIGHT_SLEEP_MAX_US);
+
+  Serial.flush();
+  esp_light_sleep_start();
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO && !captureWakeEdge())
+  {
+    Serial.println("Woke from light sleep, input already released");
+  }
+  disarmWakeSources();
+}
+
+/**
+ * Let PM pick the CPU clock and light sleep in the idle task. Tickless
+ * idle only sleeps while inputPmLock is released, because the encoder's edge
+ * interrupts stop in light sleep and must keep running while the knob is in use.
+ */
+void configurePowerManagement()
+{
+#if CONFIG_IDF_TARGET_ESP32C3
+  esp_pm_config_esp32c3_t pmConfig = {};
+#else
+  esp_pm_config_esp32_t pmConfig = {};
+#endif
+  pmConfig.max_freq_mhz = ACTIVE_CPU_FREQ;
+  pmConfig.min_freq_mhz = INACTIVE_CPU_FREQ;
+  pmConfig.light_sleep_enable = true;
+
+  esp_err_t err = esp_pm_configure(&pmConfig);
+  if (err != ESP_OK)
+  {
+    Serial.printf("Power management unavailable (%s)\n", esp_err_to_name(err));
+    return;
+  }
+
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "input", &inputPmLock);
+  esp_pm_lock_acquire(inputPmLock);
+  Serial.println("Auto light sleep enabled");
+}
+
+/**
+ * Idle: arm the wake sources and release the lock so the idle task can
+ * light sleep between loop iterations
+ */
+void armAutoLightSleep()
+{
+  if (autoLightSleepArmed || inputPmLock == NULL)
+    return;
+
+  armWakeSources();
+  autoLightSleepArmed = true;
+  esp_pm_lock_release(inputPmLock);
+}
+
+/**
+ * Called every loop while armed. An input away from its resting level is
+ * latched like a manual wake; any input or a busier BLE state takes the
+ * lock back so continuous sensing resumes.
+ */
+void checkAutoLightSleepWake()
+{
+  if (!autoLightSleepArmed)
+    return;
+
+  bool stillIdle = lightSleepAllowed() && millis() - lastInputTime > LIGHT_SLEEP_TIMEOUT;
+  if (!captureWakeEdge() && stillIdle)
+    return;
+
+  esp_pm_lock_acquire(inputPmLock);
+  autoLightSleepArmed = false;
+  disarmWakeSources();
+}
+
 // ===== MAIN LOOP =====
 void loop()
 {
 
-  // // Process button events
-  encButton.tick();
+  // Take back continuous sensing if an input woke us from auto light sleep
+  checkAutoLightSleepWake();
+
+  // // Process button events, a latched wake press counts as pressed
+  encButton.tick(inputActive(ENC_BUTTON_WAKE_INDEX, ENCODER_PIN_SW));
+  bool buttonPressed = !encButton.isIdle();
 
   // Process media button events
   for (int i = 0; i < NUM_MEDIA_BUTTONS; i++)
   {
-    mediaButtons[i].button.tick();
+    mediaButtons[i].button.tick(inputActive(i, mediaButtons[i].pin));
+    buttonPressed |= !mediaButtons[i].button.isIdle();
+  }
+
+  // OneButton leaves idle once the press is debounced, long before a click callback
+  if (buttonPressed)
+  {
+    reportWakeLatency();
   }
   encoderRotaryLoop();
-  // Handle BLE connection changes
-  handleConnectionChanges();
+  // Advance the BLE connection state machine
+  bleLink.update(millis(), lastInputTime);
 
   // Check reed switch state periodically
   if (millis() - lastReedCheckTime > REED_CHECK_INTERVAL)
@@ -529,7 +936,7 @@ void loop()
     if (reedState == LOW && prevReedState == HIGH)
     {
       Serial.println("Reed switch changed to LOW, dont forget to uncomment the deep sleep line in the code");
-      // enterDeepSleep();           // Uncomment this line to enable deep sleep on reed switch LOW   REMEMBER TO UNCOMMENT YOU IDIOT AAAAA
+      // requestDeepSleep();           // Uncomment this line to enable deep sleep on reed switch LOW   REMEMBER TO UNCOMMENT YOU IDIOT AAAAA
     }
 
     prevReedState = reedState;
@@ -541,5 +948,19 @@ void loop()
     resetEncoder(); // Reset encoder position every minute
   }
 
-  delay(2); // Small delay to avoid busy-waiting
+  // Light sleep once idle, the wake path latches the input that woke us
+  if (millis() - lastInputTime > LIGHT_SLEEP_TIMEOUT && lightSleepAllowed())
+  {
+    if (ENABLE_AUTO_LIGHT_SLEEP)
+    {
+      armAutoLightSleep(); // The idle task sleeps through the delay below
+    }
+    else
+    {
+      enterLightSleep();
+      return;
+    }
+  }
+
+  delay(autoLightSleepArmed ? 10 : 2); // Small delay to avoid busy-waiting, longer sleeps while idle
 }
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include "BleLink.h"
+#include <string.h>
+
+BleLink *BleLink::s_instance = nullptr;
+
+/**
+ * Register for GAP completion events and start advertising
+ */
+void BleLink::begin(BLEServer *server, BleLinkCallbacks *callbacks, uint32_t nowMs)
+{
+  s_instance = this;
+  m_server = server;
+  m_callbacks = callbacks;
+  m_nowMs = nowMs;
+  BLEDevice::setCustomGapHandler(gapEventHandler);
+  enterState(BLE_ADVERTISING);
+}
+
+const char *BleLink::stateName(BleState state)
+{
+  switch (state)
+  {
+  case BLE_ADVERTISING:
+    return "advertising";
+  case BLE_CONNECTING:
+    return "connecting";
+  case BLE_CONNECTED_ACTIVE:
+    return "connected-active";
+  case BLE_CONNECTED_IDLE:
+    return "connected-idle";
+  case BLE_DISCONNECTING:
+    return "disconnecting";
+  case BLE_DEINIT:
+    return "deinit";
+  }
+  return "unknown";
+}
+
+// ===== STACK CALLBACKS (BLE task) =====
+/**
+ * Hand a stack event to the state machine, dropped if loop() has fallen
+ * a whole queue behind
+ */
+void BleLink::postEvent(BleEvent event)
+{
+  uint8_t head = m_eventHead.load(std::memory_order_relaxed);
+  uint8_t next = (head + 1) % BLE_EVENT_QUEUE_LENGTH;
+  if (next == m_eventTail.load(std::memory_order_acquire))
+    return;
+
+  m_events[head] = event;
+  m_eventHead.store(next, std::memory_order_release);
+}
+
+bool BleLink::takeEvent(BleEvent *event)
+{
+  uint8_t tail = m_eventTail.load(std::memory_order_relaxed);
+  if (tail == m_eventHead.load(std::memory_order_acquire))
+    return false;
+
+  *event = m_events[tail];
+  m_eventTail.store((tail + 1) % BLE_EVENT_QUEUE_LENGTH, std::memory_order_release);
+  return true;
+}
+
+void BleLink::onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
+{
+  m_connected = true;
+  memcpy(m_remoteAddress, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+  m_connIntervalMs = (param->connect.conn_params.interval * 5) / 4; // The host's interval until an update lands
+  TAPPIE_LOG("Device connected\n");
+  postEvent(BLE_EVT_CONNECTED);
+}
+
+void BleLink::onDisconnect(BLEServer *pServer)
+{
+  m_connected = false;
+  if (m_callbacks)
+  {
+    m_callbacks->onLinkDisconnected();
+  }
+  TAPPIE_LOG("Device disconnected\n");
+  postEvent(BLE_EVT_DISCONNECTED);
+}
+
+/**
+ * The host enabling position notifications marks the connection as usable
+ */
+void BleLink::SubscribeCallbacks::onWrite(BLEDescriptor *pDescriptor)
+{
+  if (((BLE2902 *)pDescriptor)->getNotifications())
+  {
+    m_link->postEvent(BLE_EVT_SUBSCRIBED);
+  }
+}
+
+/**
+ * GAP completion events for advertising and connection parameter updates
+ */
+void BleLink::gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+  BleLink *link = s_instance;
+  if (link == nullptr)
+    return;
+
+  switch (event)
+  {
+  case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+    link->postEvent(param->adv_start_cmpl.status == ESP_BT_STATUS_SUCCESS ? BLE_EVT_ADV_STARTED : BLE_EVT_ADV_FAILED);
+    break;
+  case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+    if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS)
+    {
+      link->m_connIntervalMs = (param->update_conn_params.conn_int * 5) / 4; // 1.25ms units
+    }
+    link->postEvent(param->update_conn_params.status == ESP_BT_STATUS_SUCCESS ? BLE_EVT_CONN_PARAMS_UPDATED : BLE_EVT_CONN_PARAMS_REJECTED);
+    break;
+  default:
+    break;
+  }
+}
+
+// ===== STATE MACHINE (loop) =====
+/**
+ * Ask the host for the connection parameters matching the current state
+ */
+void BleLink::requestConnParams()
+{
+  if (m_state == BLE_CONNECTED_IDLE)
+  {
+    m_server->updateConnParams(m_remoteAddress, BLE_IDLE_MIN_CONN_INTERVAL, BLE_IDLE_MAX_CONN_INTERVAL,
+                               BLE_IDLE_SLAVE_LATENCY, BLE_SUPERVISION_TIMEOUT);
+  }
+  else
+  {
+    m_server->updateConnParams(m_remoteAddress, BLE_ACTIVE_MIN_CONN_INTERVAL, BLE_ACTIVE_MAX_CONN_INTERVAL,
+                               0, BLE_SUPERVISION_TIMEOUT);
+  }
+  m_connParamsPending = true;
+  m_connParamsRequestMs = m_nowMs;
+}
+
+/**
+ * Switch state and start whatever the new state waits on
+ */
+void BleLink::enterState(BleState state)
+{
+  m_state = state;
+  m_stateEnteredMs = m_nowMs;
+  TAPPIE_LOG("BLE state: %s\n", stateName(state));
+
+  switch (state)
+  {
+  case BLE_ADVERTISING:
+    m_connParamsPending = false;
+    m_advertisingConfirmed = false;
+    m_advertisingStartMs = m_nowMs;
+    m_server->startAdvertising();
+    break;
+  case BLE_CONNECTED_ACTIVE:
+  case BLE_CONNECTED_IDLE:
+    m_connParamRetries = 0;
+    requestConnParams();
+    break;
+  case BLE_DISCONNECTING:
+    m_server->disconnect(m_server->getConnId());
+    break;
+  case BLE_DEINIT:
+    // Only reached on the way to deep sleep, nothing may touch BLE objects after this
+    if (m_callbacks)
+    {
+      m_callbacks->onLinkDeinit();
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void BleLink::handleEvent(BleEvent event)
+{
+  switch (event)
+  {
+  case BLE_EVT_ADV_STARTED:
+    m_advertisingConfirmed = true;
+    break;
+  case BLE_EVT_ADV_FAILED:
+    TAPPIE_LOG("Advertising failed to start\n");
+    break;
+  case BLE_EVT_CONNECTED:
+    if (m_state == BLE_ADVERTISING)
+    {
+      if (m_callbacks)
+      {
+        m_callbacks->onLinkConnected();
+      }
+      enterState(BLE_CONNECTING);
+    }
+    break;
+  case BLE_EVT_SUBSCRIBED:
+    if (m_state == BLE_CONNECTING)
+    {
+      if (m_callbacks)
+      {
+        m_callbacks->onLinkReady();
+      }
+      enterState(BLE_CONNECTED_ACTIVE);
+    }
+    break;
+  case BLE_EVT_DISCONNECTED:
+    if (m_state == BLE_DISCONNECTING)
+    {
+      enterState(BLE_DEINIT);
+    }
+    else if (m_state != BLE_DEINIT)
+    {
+      enterState(BLE_ADVERTISING); // Stack is ready again once it reports the disconnect
+    }
+    break;
+  case BLE_EVT_CONN_PARAMS_UPDATED:
+    m_connParamsPending = false;
+    break;
+  case BLE_EVT_CONN_PARAMS_REJECTED:
+    TAPPIE_LOG("Connection parameters rejected\n");
+    break;
+  }
+}
+
+/**
+ * Retry a parameter update that was rejected or never answered
+ */
+void BleLink::retryConnParams()
+{
+  if (!m_connParamsPending || m_nowMs - m_connParamsRequestMs < CONN_PARAM_RETRY_INTERVAL)
+    return;
+
+  if (m_connParamRetries >= CONN_PARAM_MAX_RETRIES)
+  {
+    TAPPIE_LOG("Keeping host connection parameters\n");
+    m_connParamsPending = false;
+    return;
+  }
+
+  m_connParamRetries++;
+  requestConnParams();
+}
+
+/**
+ * Drain stack events and run state timeouts, never blocks. lastInputMs
+ * picks between the active and idle connection parameters.
+ */
+void BleLink::update(uint32_t nowMs, uint32_t lastInputMs)
+{
+  m_nowMs = nowMs;
+
+  BleEvent event;
+  while (m_state != BLE_DEINIT && takeEvent(&event))
+  {
+    handleEvent(event);
+  }
+
+  if (m_deepSleepRequested && m_state != BLE_DISCONNECTING && m_state != BLE_DEINIT)
+  {
+    enterState(m_connected ? BLE_DISCONNECTING : BLE_DEINIT);
+  }
+
+  uint32_t inState = m_nowMs - m_stateEnteredMs;
+  switch (m_state)
+  {
+  case BLE_ADVERTISING:
+    if (!m_advertisingConfirmed && m_nowMs - m_advertisingStartMs > ADVERTISING_START_TIMEOUT)
+    {
+      TAPPIE_LOG("Advertising not confirmed, retrying\n");
+      m_advertisingStartMs = m_nowMs;
+      m_server->startAdvertising();
+    }
+    break;
+  case BLE_CONNECTING:
+    if (inState > CONNECTING_TIMEOUT)
+    {
+      if (m_callbacks)
+      {
+        m_callbacks->onLinkReady();
+      }
+      enterState(BLE_CONNECTED_ACTIVE);
+    }
+    break;
+  case BLE_CONNECTED_ACTIVE:
+    if (m_nowMs - lastInputMs > CONNECTED_IDLE_TIMEOUT)
+    {
+      enterState(BLE_CONNECTED_IDLE);
+    }
+    else
+    {
+      retryConnParams();
+    }
+    break;
+  case BLE_CONNECTED_IDLE:
+    if (m_nowMs - lastInputMs <= CONNECTED_IDLE_TIMEOUT)
+    {
+      enterState(BLE_CONNECTED_ACTIVE);
+    }
+    else
+    {
+      retryConnParams();
+    }
+    break;
+  case BLE_DISCONNECTING:
+    if (inState > DISCONNECT_TIMEOUT)
+    {
+      TAPPIE_LOG("Disconnect not confirmed, deinit anyway\n");
+      enterState(BLE_DEINIT);
+    }
+    break;
+  case BLE_DEINIT:
+    break;
+  }
+}
@@ -0,0 +1,128 @@
+/**
+ * TappieLink - BLE connection lifecycle
+ *
+ * Stack callbacks only post events; update(), called from loop(), drives
+ * the state machine and its timeouts so the firmware never blocks on the
+ * stack. The same code runs on the board and, over SimBLE, in the native
+ * sim.
+ */
+
+#pragma once
+
+#include "TappieBLE.h"
+#include <atomic>
+
+// ===== BLE CONNECTION CONSTANTS =====
+#define ADVERTISING_START_TIMEOUT 1000    // Restart advertising if the stack hasn't confirmed it started
+#define CONNECTING_TIMEOUT 3000           // Treat the link as up if the host never subscribes
+#define CONNECTED_IDLE_TIMEOUT 10000      // No input for this long switches to idle connection parameters
+#define CONN_PARAM_RETRY_INTERVAL 2000    // Wait before retrying a rejected or unanswered parameter update
+#define CONN_PARAM_MAX_RETRIES 3          // Then keep whatever the host chose
+#define DISCONNECT_TIMEOUT 1000           // Deinit anyway if the disconnect is never confirmed
+#define BLE_ACTIVE_MIN_CONN_INTERVAL 0x06 // 7.5ms while the knob is in use, so steps go out without queueing
+#define BLE_ACTIVE_MAX_CONN_INTERVAL 0x0C // 15ms
+#define BLE_IDLE_MIN_CONN_INTERVAL 0x50   // 100ms once idle
+#define BLE_IDLE_MAX_CONN_INTERVAL 0xA0   // 200ms
+#define BLE_IDLE_SLAVE_LATENCY 4          // Connection events the device may skip while idle
+#define BLE_SUPERVISION_TIMEOUT 400       // 4 seconds (10ms units)
+#define BLE_EVENT_QUEUE_LENGTH 8
+
+// BLE connection lifecycle, driven by stack events and timers in BleLink::update()
+enum BleState
+{
+  BLE_ADVERTISING,
+  BLE_CONNECTING,
+  BLE_CONNECTED_ACTIVE,
+  BLE_CONNECTED_IDLE,
+  BLE_DISCONNECTING,
+  BLE_DEINIT
+};
+
+// Stack events posted from BLE callbacks, handled in BleLink::update()
+enum BleEvent
+{
+  BLE_EVT_ADV_STARTED,
+  BLE_EVT_ADV_FAILED,
+  BLE_EVT_CONNECTED,
+  BLE_EVT_SUBSCRIBED,
+  BLE_EVT_DISCONNECTED,
+  BLE_EVT_CONN_PARAMS_UPDATED,
+  BLE_EVT_CONN_PARAMS_REJECTED
+};
+
+/**
+ * What the firmware does at each step of the lifecycle. All of them run
+ * from update() except onLinkDisconnected(), which runs in the BLE task.
+ */
+class BleLinkCallbacks
+{
+public:
+  virtual ~BleLinkCallbacks() {}
+  virtual void onLinkConnected() {}    // New host, not subscribed yet
+  virtual void onLinkReady() {}        // Host subscribed, or never did within CONNECTING_TIMEOUT
+  virtual void onLinkDisconnected() {} // Link dropped, from the BLE task
+  virtual void onLinkDeinit() {}       // Deep sleep requested and the link is down, tear down BLE and sleep
+};
+
+class BleLink : public BLEServerCallbacks
+{
+public:
+  void begin(BLEServer *server, BleLinkCallbacks *callbacks, uint32_t nowMs);
+  void update(uint32_t nowMs, uint32_t lastInputMs);
+  void requestDeepSleep() { m_deepSleepRequested = true; }
+
+  BleState state() const { return m_state; }
+  static const char *stateName(BleState state);
+  bool isConnected() const { return m_connected; }
+  uint16_t connIntervalMs() const { return m_connIntervalMs; }
+
+  // Set on the position characteristic's CCCD, the subscribe marks the link usable
+  BLEDescriptorCallbacks *subscribeCallbacks() { return &m_subscribeCallbacks; }
+
+  void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) override;
+  void onDisconnect(BLEServer *pServer) override;
+
+private:
+  class SubscribeCallbacks : public BLEDescriptorCallbacks
+  {
+  public:
+    explicit SubscribeCallbacks(BleLink *link) : m_link(link) {}
+    void onWrite(BLEDescriptor *pDescriptor) override;
+
+  private:
+    BleLink *m_link;
+  };
+
+  static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+  void postEvent(BleEvent event);
+  bool takeEvent(BleEvent *event);
+  void handleEvent(BleEvent event);
+  void enterState(BleState state);
+  void requestConnParams();
+  void retryConnParams();
+
+  static BleLink *s_instance;
+
+  BLEServer *m_server = nullptr;
+  BleLinkCallbacks *m_callbacks = nullptr;
+  SubscribeCallbacks m_subscribeCallbacks{this};
+
+  // Single producer (BLE task), single consumer (loop)
+  BleEvent m_events[BLE_EVENT_QUEUE_LENGTH];
+  std::atomic<uint8_t> m_eventHead{0};
+  std::atomic<uint8_t> m_eventTail{0};
+
+  BleState m_state = BLE_ADVERTISING;
+  uint32_t m_nowMs = 0;
+  uint32_t m_stateEnteredMs = 0;
+  uint32_t m_advertisingStartMs = 0;
+  bool m_advertisingConfirmed = false;
+  bool m_connParamsPending = false;
+  uint32_t m_connParamsRequestMs = 0;
+  uint8_t m_connParamRetries = 0;
+  bool m_deepSleepRequested = false;
+  esp_bd_addr_t m_remoteAddress = {};
+  volatile bool m_connected = false;
+  volatile uint16_t m_connIntervalMs = 15; // Current connection interval, set on connect and updated from GAP events
+};
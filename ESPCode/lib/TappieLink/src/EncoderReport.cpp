@@ -0,0 +1,119 @@
+#include "EncoderReport.h"
+#include <stdio.h>
+
+EncoderReport::EncoderReport(int countsPerDetent, int wheelDirection)
+    : m_countsPerDetent(countsPerDetent), m_wheelDirection(wheelDirection)
+{
+}
+
+void EncoderReport::begin(BLECharacteristic *positionChara, BLECharacteristic *wheelReport)
+{
+  m_positionChara = positionChara;
+  m_wheelReport = wheelReport;
+}
+
+/**
+ * Appended to every position value as " <level>"
+ */
+void EncoderReport::setBatteryLevel(int level)
+{
+  snprintf(m_batterySuffix, sizeof(m_batterySuffix), " %d", level);
+}
+
+/**
+ * Notify a position change and feed the HID wheel. Returns true when the
+ * position changed.
+ */
+bool EncoderReport::update(int64_t rawCount, uint32_t nowMs, bool connected, uint16_t connIntervalMs)
+{
+  m_currentPosition = rawCount / m_countsPerDetent;
+
+  // Accumulate raw counts for the HID wheel, sent once per connection event.
+  // Turns with no host connected are not saved up for the next one.
+  if (m_wheelReport)
+  {
+    if (connected)
+    {
+      m_hidWheelPending += rawCount - m_lastHidCount;
+    }
+    m_lastHidCount = rawCount;
+    sendWheel(nowMs, connected, connIntervalMs);
+  }
+
+  if (m_currentPosition == m_prevPosition)
+    return false;
+
+  sendPosition();
+  m_prevPosition = m_currentPosition;
+  return true;
+}
+
+/**
+ * Send the current position, also used once the host is listening
+ */
+void EncoderReport::sendPosition()
+{
+  char value[24];
+  snprintf(value, sizeof(value), "%d%s", m_currentPosition, m_batterySuffix);
+  TAPPIE_LOG("%s\n", value);
+  m_positionChara->setValue(value);
+  m_positionChara->notify();
+}
+
+/**
+ * Zero the position after the caller cleared the PCNT count, and tell a
+ * connected host
+ */
+void EncoderReport::reset(bool connected, uint32_t nowMs)
+{
+  m_lastHidCount = 0;
+  m_hidWheelPending = 0;
+  m_prevPosition = 0;
+  m_currentPosition = 0;
+
+  if (connected)
+  {
+    char value[16];
+    snprintf(value, sizeof(value), "reset%s", m_batterySuffix);
+    TAPPIE_LOG("%s\n", value);
+    m_positionChara->setValue(value);
+    m_positionChara->notify();
+  }
+
+  m_lastActivityMs = nowMs;
+}
+
+/**
+ * Auto-reset after inactivity, only if not at zero
+ */
+bool EncoderReport::autoResetDue(uint32_t nowMs) const
+{
+  return nowMs - m_lastActivityMs > AUTO_RESET_TIMEOUT && m_currentPosition != 0;
+}
+
+/**
+ * Send the wheel movement accumulated since the last report, at most once
+ * per connection interval so each report carries everything the host
+ * would otherwise get as several packets in the same connection event
+ */
+void EncoderReport::sendWheel(uint32_t nowMs, bool connected, uint16_t connIntervalMs)
+{
+  if (!connected || m_hidWheelPending == 0 || nowMs - m_lastHidReportMs < connIntervalMs)
+    return;
+
+  // Without the multiplier the host expects whole detents
+  int32_t unit = m_highResolution ? 1 : m_countsPerDetent;
+  int32_t wheel = m_hidWheelPending / unit;
+  if (wheel > 127)
+    wheel = 127;
+  else if (wheel < -127)
+    wheel = -127;
+  if (wheel == 0)
+    return;
+  m_hidWheelPending -= wheel * unit;
+
+  uint8_t report[] = {0, 0, 0, (uint8_t)(int8_t)(wheel * m_wheelDirection)};
+  m_wheelReport->setValue(report, sizeof(report));
+  m_wheelReport->notify();
+  m_lastHidReportMs = nowMs;
+}
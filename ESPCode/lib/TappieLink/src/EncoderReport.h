@@ -0,0 +1,52 @@
+/**
+ * TappieLink - Encoder notify path
+ *
+ * Turns the raw PCNT count into what the host sees: position notifications
+ * with the battery suffix, the inactivity reset, and the optional HID wheel
+ * coalesced to one report per connection interval.
+ */
+
+#pragma once
+
+#include "TappieBLE.h"
+
+#define AUTO_RESET_TIMEOUT 5000 // 5 seconds in milliseconds
+
+class EncoderReport
+{
+public:
+  EncoderReport(int countsPerDetent, int wheelDirection);
+
+  // wheelReport may be NULL when the HID wheel is disabled
+  void begin(BLECharacteristic *positionChara, BLECharacteristic *wheelReport);
+  void setBatteryLevel(int level);
+
+  bool update(int64_t rawCount, uint32_t nowMs, bool connected, uint16_t connIntervalMs);
+  void reset(bool connected, uint32_t nowMs);
+  void sendPosition();
+  bool autoResetDue(uint32_t nowMs) const;
+
+  int position() const { return m_currentPosition; }
+  void setHighResolution(bool enable) { m_highResolution = enable; }
+  bool highResolution() const { return m_highResolution; }
+
+private:
+  void sendWheel(uint32_t nowMs, bool connected, uint16_t connIntervalMs);
+
+  int m_countsPerDetent;
+  int m_wheelDirection;
+  BLECharacteristic *m_positionChara = nullptr;
+  BLECharacteristic *m_wheelReport = nullptr;
+  char m_batterySuffix[8] = "";
+
+  // Encoder position tracking
+  int m_prevPosition = 0;
+  int m_currentPosition = 0;
+  uint32_t m_lastActivityMs = 0; // Timer for auto-reset
+
+  // HID wheel coalescing: raw counts accumulated until the next connection event
+  int64_t m_lastHidCount = 0;
+  int32_t m_hidWheelPending = 0;
+  uint32_t m_lastHidReportMs = 0;
+  volatile bool m_highResolution = false; // Host enabled the resolution multiplier
+};
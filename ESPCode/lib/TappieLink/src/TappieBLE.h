@@ -0,0 +1,19 @@
+/**
+ * TappieLink - BLE stack selection
+ *
+ * The firmware builds against the Arduino BLE library, the native env
+ * against SimBLE, which keeps the same class and callback signatures.
+ */
+
+#pragma once
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLE2902.h>
+#define TAPPIE_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#include <SimBLE.h>
+#define TAPPIE_LOG(...) ((void)0)
+#endif
@@ -14,7 +14,12 @@ ENC_BUTTON_UUID = "0c2f5fbe-c20f-49ec-8c7c-ce0c9358e574"
 MEDIA_SINGLEBUTTON_UUID = "9ff67916-665f-4489-b257-46d118b1e5eb"
 MEDIA_DOUBLEBUTTON_UUID = "66f1ab02-c93d-44fe-8ca9-5e8bdbb2fe80"
 
-DEVICE_NAME = "TappieV2"
+DEVICE_NAME = "TappieV2"  # Name prefix, each knob advertises "TappieV2-XXXX"
+
+# Device identity, advertised as manufacturer data: ID (4 bytes, big endian) + role
+MANUFACTURER_ID = 0xFFFF
+# IDs of the knobs to bind, e.g. ["A1B2C3D4", "0E0F1011"]. Empty binds the first Tappie found
+TAPPIE_DEVICE_IDS = []
 
 # Application constants
 RECONNECT_DELAY = 10  # seconds
@@ -53,7 +58,7 @@ class TappieController:
         self.ahk.menu_tray_icon(defaultDirectory + "\\icons\\tappieIcon.ico")
         self.ahk.menu_tray_tooltip("Tappie V2")
         self.selected_device = "Master"
-        self.prev_enc_position = 0
+        self.prev_enc_positions = {}  # Last position per knob ID
         self.reset_timer = None
         self.last_volume_change = time.time()
         self.previousBatteryLevel = None  # Add this line
@@ -228,7 +233,7 @@ class TappieController:
         else:
             print(f"Unknown device: {device_name}")
     
-    def handle_encoder_position(self, encData):
+    def handle_encoder_position(self, encData, knob_id=None):
         # Handle encoder position changes with better error handling
         try:
             # Split the combined string (format: "position batteryLevel")
@@ -251,22 +256,23 @@ class TappieController:
             # Process position
             if position == "reset":
                 print("Encoder position reset")
-                self.prev_enc_position = 0
+                self.prev_enc_positions[knob_id] = 0
                 return
             
             # Convert position to integer with error handling
             try:
                 current_position = int(position)
-                if current_position > self.prev_enc_position:
+                prev_enc_position = self.prev_enc_positions.get(knob_id, 0)
+                if current_position > prev_enc_position:
                     print(f"Encoder position increased: {position}")
                     self.adjust_volume(increase=True)
-                elif current_position < self.prev_enc_position:
+                elif current_position < prev_enc_position:
                     print(f"Encoder position decreased: {position}")
                     self.adjust_volume(increase=False)
                 else:
                     print(f"Encoder position unchanged: {position}")
                     
-                self.prev_enc_position = current_position
+                self.prev_enc_positions[knob_id] = current_position
                 
             except ValueError:
                 print(f"Error: Could not convert position '{position}' to integer")
@@ -316,17 +322,27 @@ class TappieController:
 class BLEClient:
     #BLE client that connects to the Tappie device#
     
-    def __init__(self, controller):
-        #Initialize with a controller instance#
+    def __init__(self, controller, device_id=None):
+        #Initialize with a controller instance and optionally the ID of the knob to bind#
         self.controller = controller
+        self.device_id = device_id.upper() if device_id else None
+        self.label = f"{DEVICE_NAME} {self.device_id}" if self.device_id else DEVICE_NAME
+
+    def matches_advertisement(self, device, advertisement_data):
+        #Match Tappie advertisements by ID in the manufacturer data#
+        data = advertisement_data.manufacturer_data.get(MANUFACTURER_ID)
+        if data is None or len(data) < 5:
+            return False
+        advertised_id = data[:4].hex().upper()
+        return self.device_id is None or advertised_id == self.device_id
         
     async def find_device(self):
-        #Find the BLE device by name#
-        print(f"Scanning for {DEVICE_NAME}...")
-        device = await BleakScanner.find_device_by_name(DEVICE_NAME)
+        #Find the BLE device by advertised ID, stopping at the first match#
+        print(f"Scanning for {self.label}...")
+        device = await BleakScanner.find_device_by_filter(self.matches_advertisement)
         
         if not device:
-            print(f"Could not find {DEVICE_NAME}")
+            print(f"Could not find {self.label}")
             print("Available devices:")
             devices = await BleakScanner.discover()
             for d in devices:
@@ -360,7 +376,7 @@ class BLEClient:
     def setup_notification_handlers(self, client):
         #Set up notification handlers for the client#
         async def enc_pos_handler(_, data):
-            self.controller.handle_encoder_position(data.decode())
+            self.controller.handle_encoder_position(data.decode(), self.device_id)
             
         async def enc_button_handler(_, data):
             self.controller.handle_encoder_button(data.decode())
@@ -458,10 +474,13 @@ class BLEClient:
 async def main():
     #Application entry point#
     controller = TappieController()
-    client = BLEClient(controller)
+    if TAPPIE_DEVICE_IDS:
+        clients = [BLEClient(controller, device_id) for device_id in TAPPIE_DEVICE_IDS]
+    else:
+        clients = [BLEClient(controller)]
     
     try:
-        await client.main_loop()
+        await asyncio.gather(*(client.main_loop() for client in clients))
     finally:
         controller.cleanup()
 